@@ -0,0 +1,289 @@
+#include "checkpoint.hpp"
+#include "layout.hpp"
+#include "zlib.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace pl {
+
+constexpr uint32_t sidecar_magic = 0x4b43'4c50; // "PLCK"
+constexpr uint32_t sidecar_version = 1;
+
+constexpr size_t input_chunk_size = 64 << 10;
+
+struct sidecar_header {
+    uint32_t magic = sidecar_magic;
+    uint32_t version = sidecar_version;
+    uint32_t pak_crc = 0; // stale after patch/pack
+    uint32_t count = 0;   // items
+};
+
+struct sidecar_item {
+    uint32_t index = 0;
+    uint32_t count = 0; // checkpoints
+};
+
+struct sidecar_point {
+    int64_t out = 0;
+    int64_t in = 0;
+    uint8_t bits = 0;
+    uint32_t window = 0; // bytes following
+};
+
+using header_layout = layout::record<layout::field<&sidecar_header::magic>,
+                                     layout::field<&sidecar_header::version>,
+                                     layout::field<&sidecar_header::pak_crc>,
+                                     layout::field<&sidecar_header::count>>;
+
+using item_layout = layout::record<layout::field<&sidecar_item::index>,
+                                   layout::field<&sidecar_item::count>>;
+
+using point_layout = layout::record<layout::field<&sidecar_point::out>,
+                                    layout::field<&sidecar_point::in>,
+                                    layout::field<&sidecar_point::bits>,
+                                    layout::field<&sidecar_point::window>>;
+
+//-----------------------------------------------------------------------------
+checkpoint_index::ptr checkpoint_index::load(fs::path const& file, uint32_t pak_crc) {
+    std::ifstream input(file, std::ios::binary);
+    if (!input)
+        return nullptr;
+
+    std::vector<char> data{std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+    auto const end = data.data() + data.size();
+
+    sidecar_header header;
+    auto pos = header_layout::read(data.data(), end, header);
+    if (!pos || (header.magic != sidecar_magic) || (header.version != sidecar_version) || (header.pak_crc != pak_crc))
+        return nullptr;
+
+    auto result = create();
+    for (auto i = 0u; i < header.count; ++i) {
+        sidecar_item item;
+        if (!(pos = item_layout::read(pos, end, item)))
+            return nullptr;
+
+        auto& points = result->items[item.index];
+        points.resize(item.count);
+
+        for (auto& point : points) {
+            sidecar_point stored;
+            if (!(pos = point_layout::read(pos, end, stored)) || (end - pos < ptrdiff_t(stored.window)))
+                return nullptr;
+
+            point.out = stored.out;
+            point.in = stored.in;
+            point.bits = stored.bits;
+            point.window.assign(pos, stored.window);
+            pos += stored.window;
+        }
+    }
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+bool checkpoint_index::save(fs::path const& file, uint32_t pak_crc) const {
+    std::string data(header_layout::fixed_size, '\0');
+
+    sidecar_header header;
+    header.pak_crc = pak_crc;
+    header.count = uint32_t(items.size());
+    header_layout::write(data.data(), header);
+
+    for (auto const& [index, points] : items) {
+        sidecar_item const item = {index, uint32_t(points.size())};
+
+        auto const item_pos = data.size();
+        data.resize(item_pos + item_layout::fixed_size);
+        item_layout::write(data.data() + item_pos, item);
+
+        for (auto const& point : points) {
+            sidecar_point const stored = {point.out, point.in, point.bits, uint32_t(point.window.size())};
+
+            auto const point_pos = data.size();
+            data.resize(point_pos + point_layout::fixed_size);
+            point_layout::write(data.data() + point_pos, stored);
+
+            data += point.window;
+        }
+    }
+
+    std::ofstream output(file, std::ios::binary | std::ios::trunc);
+    if (!output)
+        return false;
+
+    output.write(data.data(), data.size());
+    return bool(output);
+}
+
+//-----------------------------------------------------------------------------
+// zlib examples/zran.c: Z_BLOCK stops at every block end, the last 32 KB of
+// output are kept in a circular window
+bool checkpoint_index::build(std::istream& input, int64_t size, int64_t span, checkpoint::list& points) {
+    points.clear();
+
+    z_stream stream = {};
+    if (inflateInit2(&stream, 47) != Z_OK) // gzip or zlib
+        return false;
+
+    std::vector<unsigned char> chunk(input_chunk_size);
+    std::vector<unsigned char> window(checkpoint::window_size);
+
+    int64_t total_in = 0;
+    int64_t total_out = 0;
+    int64_t last = 0;
+
+    auto res = Z_OK;
+    stream.avail_out = 0;
+
+    do {
+        if (size <= 0)
+            break; // truncated
+
+        auto const chunk_size = std::min<int64_t>(size, chunk.size());
+        if (!input.read(reinterpret_cast<char*>(chunk.data()), chunk_size))
+            break;
+
+        size -= chunk_size;
+        stream.avail_in = chunk_size;
+        stream.next_in = chunk.data();
+
+        do {
+            if (stream.avail_out == 0) {
+                stream.avail_out = window.size();
+                stream.next_out = window.data();
+            }
+
+            total_in += stream.avail_in;
+            total_out += stream.avail_out;
+            res = inflate(&stream, Z_BLOCK);
+            total_in -= stream.avail_in;
+            total_out -= stream.avail_out;
+
+            if ((res != Z_OK) && (res != Z_STREAM_END) && (res != Z_BUF_ERROR))
+                break;
+
+            if (res == Z_STREAM_END)
+                break;
+
+            // block boundary, not the last block
+            bool const boundary = (stream.data_type & 128) && !(stream.data_type & 64);
+            if (boundary && ((total_out == 0) || (total_out - last >= span))) {
+                checkpoint point;
+                point.out = total_out;
+                point.in = total_in;
+                point.bits = uint8_t(stream.data_type & 7);
+
+                // oldest byte first
+                std::string full(window.size(), '\0');
+                auto const left = stream.avail_out;
+                std::memcpy(full.data(), window.data() + window.size() - left, left);
+                std::memcpy(full.data() + left, window.data(), window.size() - left);
+
+                auto const used = std::min<int64_t>(total_out, window.size());
+                point.window = full.substr(full.size() - used);
+
+                points.push_back(std::move(point));
+                last = total_out;
+            }
+        } while (stream.avail_in != 0);
+    } while ((res == Z_OK) || (res == Z_BUF_ERROR));
+
+    inflateEnd(&stream);
+    return res == Z_STREAM_END;
+}
+
+//-----------------------------------------------------------------------------
+bool checkpoint_index::read(std::istream& input, int64_t begin, int64_t size, checkpoint::list const& points,
+                            int64_t offset, char* data, size_t& length) {
+    z_stream stream = {};
+
+    // last checkpoint at or before the offset
+    auto const it = std::upper_bound(points.begin(), points.end(), offset, [](int64_t value, checkpoint const& point) {
+        return value < point.out;
+    });
+    auto const point = (it == points.begin()) ? nullptr : &*std::prev(it);
+
+    int64_t skip = offset;
+    int64_t in = 0;
+
+    if (!point) {
+        if (inflateInit2(&stream, 47) != Z_OK)
+            return false;
+    } else {
+        if (inflateInit2(&stream, -15) != Z_OK) // raw deflate
+            return false;
+
+        skip -= point->out;
+        in = point->in - (point->bits ? 1 : 0);
+    }
+
+    input.seekg(begin + in);
+    size -= in;
+
+    if (point && point->bits) {
+        auto const byte = input.get();
+        if (!input) {
+            inflateEnd(&stream);
+            return false;
+        }
+
+        --size;
+        inflatePrime(&stream, point->bits, byte >> (8 - point->bits));
+    }
+
+    if (point && !point->window.empty())
+        inflateSetDictionary(&stream, reinterpret_cast<Bytef const*>(point->window.data()), point->window.size());
+
+    std::vector<unsigned char> chunk(input_chunk_size);
+    std::vector<unsigned char> discard(checkpoint::window_size);
+
+    auto const wanted = length;
+    length = 0;
+
+    auto res = Z_OK;
+    while (length < wanted) {
+        if (stream.avail_in == 0) {
+            if (size <= 0)
+                break; // truncated
+
+            auto const chunk_size = std::min<int64_t>(size, chunk.size());
+            if (!input.read(reinterpret_cast<char*>(chunk.data()), chunk_size))
+                break;
+
+            size -= chunk_size;
+            stream.avail_in = chunk_size;
+            stream.next_in = chunk.data();
+        }
+
+        if (skip > 0) {
+            stream.avail_out = std::min<int64_t>(skip, discard.size());
+            stream.next_out = discard.data();
+        } else {
+            stream.avail_out = wanted - length;
+            stream.next_out = reinterpret_cast<unsigned char*>(data + length);
+        }
+
+        auto const avail = stream.avail_out;
+        res = inflate(&stream, Z_NO_FLUSH);
+        if ((res != Z_OK) && (res != Z_STREAM_END) && (res != Z_BUF_ERROR))
+            break;
+
+        auto const produced = avail - stream.avail_out;
+        if (skip > 0)
+            skip -= produced;
+        else
+            length += produced;
+
+        if (res == Z_STREAM_END)
+            break;
+    }
+
+    inflateEnd(&stream);
+    return (length == wanted) || (res == Z_STREAM_END); // short at the item end
+}
+
+} // namespace pl
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pl {
+
+namespace fs = std::filesystem;
+
+// zran-style entry into a gzip item: inflate state at a deflate block boundary
+struct checkpoint {
+    using list = std::vector<checkpoint>;
+
+    static constexpr size_t window_size = 32 << 10; // deflate dictionary
+
+    int64_t out = 0;   // decompressed offset
+    int64_t in = 0;    // compressed offset of the first whole byte
+    uint8_t bits = 0;  // unused bits of the byte before, 0-7
+    std::string window; // output before, up to window_size
+};
+
+// checkpoints of large compressed items, sidecar of a pak
+struct checkpoint_index {
+    using ptr = std::shared_ptr<checkpoint_index>;
+
+    static ptr create() {
+        return std::make_shared<checkpoint_index>();
+    }
+
+    std::map<uint32_t, checkpoint::list> items; // by item index
+
+    // nullptr if missing, damaged or written for other pak content
+    static ptr load(fs::path const& file, uint32_t pak_crc);
+    bool save(fs::path const& file, uint32_t pak_crc) const;
+
+    // one gzip item read sequentially, a checkpoint every span bytes of output
+    static bool build(std::istream& input, int64_t size, int64_t span, checkpoint::list& points);
+
+    // inflates from the last checkpoint before offset, from the start without one,
+    // input is positioned by item begin + checkpoint offsets
+    static bool read(std::istream& input, int64_t begin, int64_t size, checkpoint::list const& points,
+                     int64_t offset, char* data, size_t& length);
+};
+
+} // namespace pl
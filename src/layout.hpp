@@ -0,0 +1,133 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+namespace pl::layout {
+
+template <typename T, std::endian Order>
+constexpr T convert(T value) {
+    if constexpr ((sizeof(T) > 1) && (Order != std::endian::native))
+        return std::byteswap(value);
+    else
+        return value;
+}
+
+template <typename T>
+struct member_traits;
+
+template <typename C, typename T>
+struct member_traits<T C::*> {
+    using owner = C;
+    using type = T;
+};
+
+// fixed size number, byte order resolved at compile time
+template <auto Member, std::endian Order = std::endian::little>
+struct field {
+    using owner = typename member_traits<decltype(Member)>::owner;
+    using type = typename member_traits<decltype(Member)>::type;
+
+    static_assert(std::is_trivially_copyable_v<type>);
+
+    static constexpr size_t fixed_size = sizeof(type);
+
+    static constexpr size_t size(owner const&) {
+        return fixed_size;
+    }
+
+    static char* write(char* out, owner const& value) {
+        auto const raw = convert<type, Order>(value.*Member);
+        std::memcpy(out, &raw, sizeof(raw));
+        return out + sizeof(raw);
+    }
+
+    static char const* read(char const* in, char const* end, owner& value) {
+        if (end - in < ptrdiff_t(sizeof(type)))
+            return nullptr;
+
+        type raw;
+        std::memcpy(&raw, in, sizeof(raw));
+        value.*Member = convert<type, Order>(raw);
+        return in + sizeof(raw);
+    }
+};
+
+// uint32 big endian length, 0x01 marker before 128+ names, bytes
+template <auto Member>
+struct name_field {
+    using owner = typename member_traits<decltype(Member)>::owner;
+
+    static_assert(std::is_same_v<typename member_traits<decltype(Member)>::type, std::string>);
+
+    static constexpr size_t fixed_size = sizeof(uint32_t);
+    static constexpr size_t long_name = 128;
+
+    static size_t size(owner const& value) {
+        auto const length = (value.*Member).size();
+        return fixed_size + (length >= long_name ? 1 : 0) + length;
+    }
+
+    static char* write(char* out, owner const& value) {
+        auto const& name = value.*Member;
+
+        auto const length = convert<uint32_t, std::endian::big>(uint32_t(name.size()));
+        std::memcpy(out, &length, sizeof(length));
+        out += sizeof(length);
+
+        if (name.size() >= long_name)
+            *out++ = 1;
+
+        std::memcpy(out, name.data(), name.size());
+        return out + name.size();
+    }
+
+    static char const* read(char const* in, char const* end, owner& value) {
+        if (end - in < ptrdiff_t(fixed_size))
+            return nullptr;
+
+        uint32_t length;
+        std::memcpy(&length, in, sizeof(length));
+        length = convert<uint32_t, std::endian::big>(length);
+        in += sizeof(length);
+
+        if ((in < end) && (*in == 1)) // 128+ offset
+            ++in;
+
+        if (end - in < ptrdiff_t(length))
+            return nullptr;
+
+        (value.*Member).assign(in, length);
+        return in + length;
+    }
+};
+
+// fields in file order
+template <typename... Fields>
+struct record {
+    template <typename T>
+    static size_t size(T const& value) {
+        return (Fields::size(value) + ...);
+    }
+
+    static constexpr size_t fixed_size = (Fields::fixed_size + ...); // minimum
+
+    template <typename T>
+    static char* write(char* out, T const& value) {
+        ((out = Fields::write(out, value)), ...);
+        return out;
+    }
+
+    // nullptr if the data ends early
+    template <typename T>
+    static char const* read(char const* in, char const* end, T& value) {
+        ((in = in ? Fields::read(in, end, value) : nullptr), ...);
+        return in;
+    }
+};
+
+} // namespace pl::layout
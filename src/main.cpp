@@ -1,15 +1,34 @@
 #include "argh.h"
 #include "paker.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
 #include <format>
+#include <fstream>
 #include <iostream>
 
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#endif
+
 using namespace std;
 using namespace pl;
 
 //-----------------------------------------------------------------------------
 int main(int, char* argv[]) {
     paker paker;
-    cout << format("Pagonia Land - Packing Tool - PLPaker v{}", paker.version) << endl;
+
+    argh::parser cmd_line(argv);
+
+    // data on stdout, messages on stderr
+    bool const data_output = (cmd_line[1] == "cat")
+                             || ((cmd_line[1] == "export") && (cmd_line[3].empty() || (cmd_line[3] == "-")));
+    auto& log = data_output ? cerr : cout;
+
+    log << format("Pagonia Land - Packing Tool - PLPaker v{}", paker.version) << endl;
 
     auto show_help = []() {
         cout << endl;
@@ -17,18 +36,33 @@ int main(int, char* argv[]) {
         cout << endl;
         cout << "commands:" << endl;
         cout << "  list <pak> [<dir>]           # Parse pak file and write pakinfo.json" << endl;
+        cout << "  cat <pak> <file>             # Write one item to stdout" << endl;
+        cout << "  index <pak>                  # Write inflate checkpoints of large items to <pak>.zran" << endl;
+        cout << "  analyze <pak> <json>         # Measure decode cost and compression gain per item" << endl;
         cout << endl;
         cout << "  unpack <pak> [<dir>]         # Unpack pak file into the folder" << endl;
         cout << "  pack <pakinfo> [<pak>]       # Pack new pak file based on pakinfo.json" << endl;
+        cout << "  build <dir> <pak>            # Build new pak file from all files in the folder" << endl;
+        cout << endl;
+        cout << "  export <pak> [<tar>|-]       # Write items as tar archive, stdout by default" << endl;
+        cout << "  import <tar>|- <pak>         # Build pak file from a tar archive" << endl;
         cout << endl;
         cout << "  compress <file> <out>        # Compress a file" << endl;
         cout << "  decompress <file> <out>      # Decompress a file" << endl;
         cout << endl;
         cout << "  patch <pak> <out> <files>    # Repack pak file with files to be replaced" << endl;
+        cout << "  watch <pak> <out> <dir>      # Repatch pak file whenever files in the folder change" << endl;
+        cout << endl;
+        cout << "  run <manifest>               # Run the steps of a manifest.json in one process" << endl;
         cout << endl;
         cout << "options:" << endl;
         cout << "  -c | --compress       # Unpack/Pack compressed files" << endl;
         cout << "  -d | --decompress     # Unpack/Pack decompressed files" << endl;
+        cout << "  -b | --best           # Pack/Patch/Compress with the smallest of several settings" << endl;
+        cout << "  --resume              # Unpack: continue an interrupted unpack, keep finished files" << endl;
+        cout << "  --sync                # Unpack: rewrite changed files only, remove files not in the pak" << endl;
+        cout << "  --auto-store          # Pack/Patch: store items that barely compress" << endl;
+        cout << "  --direct              # Pack/Patch: write the pak past the page cache (O_DIRECT)" << endl;
         cout << endl;
         cout << "If no options are specified, all options are active, otherwise only the set ones." << endl;
         cout << endl;
@@ -36,34 +70,187 @@ int main(int, char* argv[]) {
         cout << "  -s | --start      # Start index:    -s=38" << endl;
         cout << "  -e | --end        # End index:      -e=1602" << endl;
         cout << "  -f | --filter     # Name filter:    -f=gold" << endl;
+        cout << "  -m | --memory-limit  # Buffer budget:  -m=512M" << endl;
+        cout << "  -l | --level      # Deflate level:  -l=9" << endl;
+        cout << "  --strategy        # Deflate mode:   --strategy=filtered (default, huffman, rle, fixed)" << endl;
+        cout << "  -t | --best-time  # Search budget:  -t=1000 (ms per item)" << endl;
+        cout << "  -a | --align      # Item alignment: -a=4096 (pack/patch)" << endl;
+        cout << "  -r | --rules      # Build rules:    -r=rules.json" << endl;
+        cout << "  --store-threshold # Auto-store:     --store-threshold=10 (% saving)" << endl;
+        cout << "  --trace           # Span timeline:  --trace=trace.json (Perfetto, chrome://tracing)" << endl;
+        cout << "  --span            # Checkpoints:    --span=4M (index, output between checkpoints)" << endl;
+        cout << "  --offset          # Item range:     --offset=1M --length=4096 (cat)" << endl;
         cout << endl;
-        cout << "All parameters work on unpack and pack commands." << endl;
+        cout << "All parameters work on unpack and pack commands, the memory limit on all commands." << endl;
         cout << endl;
         cout << "Need help? Please feel free to ask us on Discord: https://Pagonia.Land" << endl;
     };
 
-    paker.on_log_info = [](string const& msg) {
-        cout << msg << endl;
+    paker.on_log_info = [&](string const& msg) {
+        log << msg << endl;
     };
     paker.on_log_error = [](string const& msg) {
         cerr << msg << endl;
     };
 
-    argh::parser cmd_line(argv);
     if ((cmd_line.pos_args().size() < 2) || cmd_line[{"-h", "--help"}]) {
         show_help();
         return 0;
     }
 
-    if (!cmd_line.flags().empty()) {
-        paker.options.compress = cmd_line[{"-d", "--compress"}];
+    if (cmd_line[{"-c", "--compress"}] || cmd_line[{"-d", "--decompress"}]) {
+        paker.options.compress = cmd_line[{"-c", "--compress"}];
         paker.options.decompress = cmd_line[{"-d", "--decompress"}];
     }
 
+    paker.options.best = cmd_line[{"-b", "--best"}];
+    paker.options.resume = cmd_line[{"--resume"}];
+    paker.options.sync = cmd_line[{"--sync"}];
+    paker.options.auto_store = cmd_line[{"--auto-store"}];
+    paker.options.direct = cmd_line[{"--direct"}];
+
     cmd_line({"-s", "--start"}) >> paker.parameters.start;
     cmd_line({"-e", "--end"}) >> paker.parameters.end;
     cmd_line({"-f", "--filter"}) >> paker.parameters.filter;
 
+    // number with an optional K, M or G suffix, nothing after it
+    auto parse_size = [](string const& text, size_t& size) {
+        auto const end = text.data() + text.size();
+        auto const [pos, ec] = std::from_chars(text.data(), end, size);
+        if ((ec != std::errc()) || (end - pos > 1))
+            return false;
+
+        auto shift = 0;
+        switch (pos != end ? std::toupper(*pos) : 0) {
+            case 0: break;
+            case 'K': shift = 10; break;
+            case 'M': shift = 20; break;
+            case 'G': shift = 30; break;
+            default: return false;
+        }
+
+        if (size > (SIZE_MAX >> shift))
+            return false;
+
+        size <<= shift;
+        return true;
+    };
+
+    string memory_limit;
+    cmd_line({"-m", "--memory-limit"}) >> memory_limit;
+    if (!memory_limit.empty()) {
+        size_t limit = 0;
+        if (!parse_size(memory_limit, limit)) {
+            cerr << format("invalid memory limit: {}", memory_limit) << endl;
+            return -1;
+        }
+
+        size_t const min_limit = 8 << 20; // streaming chunks
+        if (limit < min_limit)
+            log << format("memory limit {} raised to the minimum of 8M", memory_limit) << endl;
+
+        paker.buffers->limit = std::max(limit, min_limit);
+    }
+
+    string level;
+    string strategy;
+    cmd_line({"-l", "--level"}) >> level;
+    cmd_line({"--strategy"}) >> strategy;
+    if (!level.empty() || !strategy.empty()) {
+        compression_settings settings;
+
+        if (!level.empty()) {
+            auto const end = level.data() + level.size();
+            auto const [pos, ec] = std::from_chars(level.data(), end, settings.level);
+            if ((ec != std::errc()) || (pos != end) || (settings.level < 0) || (settings.level > 9)) {
+                cerr << format("invalid level: {}", level) << endl;
+                return -1;
+            }
+        }
+
+        if (!strategy.empty()) {
+            string_list const strategies = {"default", "filtered", "huffman", "rle", "fixed"};
+
+            auto const it = std::find(strategies.begin(), strategies.end(), strategy);
+            if (it == strategies.end()) {
+                cerr << format("invalid strategy: {}", strategy) << endl;
+                return -1;
+            }
+
+            settings.strategy = int(it - strategies.begin());
+        }
+
+        paker.parameters.compression = settings;
+    }
+
+    cmd_line({"-t", "--best-time"}) >> paker.parameters.best_time;
+    cmd_line({"--store-threshold"}) >> paker.parameters.store_threshold;
+
+    cmd_line({"-a", "--align"}) >> paker.parameters.align;
+    if (paker.parameters.align & (paker.parameters.align - 1)) {
+        cerr << format("alignment is no power of two: {}", paker.parameters.align) << endl;
+        return -1;
+    }
+
+    string rules;
+    cmd_line({"-r", "--rules"}) >> rules;
+    paker.parameters.rules = rules;
+
+    string span;
+    cmd_line({"--span"}) >> span;
+    if (!span.empty()) {
+        size_t size = 0;
+        if (!parse_size(span, size) || (size == 0) || (size > UINT32_MAX)) {
+            cerr << format("invalid span: {}", span) << endl;
+            return -1;
+        }
+        paker.parameters.checkpoint_span = uint32_t(size);
+    }
+
+    auto parse_range = [&](char const* name, int64_t& value) {
+        string text;
+        cmd_line({name}) >> text;
+        if (text.empty())
+            return true;
+
+        size_t size = 0;
+        if (!parse_size(text, size) || (size > size_t(INT64_MAX))) {
+            cerr << format("invalid range: {}", text) << endl;
+            return false;
+        }
+
+        value = int64_t(size);
+        return true;
+    };
+
+    if (!parse_range("--offset", paker.parameters.offset) || !parse_range("--length", paker.parameters.length))
+        return -1;
+
+    string trace_file;
+    cmd_line({"--trace"}) >> trace_file;
+    if (!trace_file.empty())
+        trace::start();
+
+    // written on every way out
+    struct trace_output {
+        fs::path file;
+        ostream& log;
+
+        ~trace_output() {
+            if (file.empty())
+                return;
+
+            size_t events = 0;
+            size_t dropped = 0;
+            if (!trace::write(file, events, dropped)) {
+                cerr << format("cannot write file: {}", file.string()) << endl;
+                return;
+            }
+
+            log << format("trace: {} ({} spans, {} dropped)", file.string(), events, dropped) << endl;
+        }
+    } const trace_guard{trace_file, log};
+
     auto const command = cmd_line[1];
     auto const input = cmd_line[2];
     auto const output = cmd_line[3];
@@ -105,6 +292,25 @@ int main(int, char* argv[]) {
         return output_path;
     };
 
+    auto prepare_output_file = [&]() -> fs::path {
+        if (output.empty()) {
+            cerr << "no output file set" << endl;
+            show_help();
+            return {};
+        }
+
+        fs::path const output_file = output;
+        auto const parent_path = output_file.parent_path();
+        if (!fs::exists(parent_path)) {
+            if (!fs::create_directories(parent_path)) {
+                cerr << format("cannot create folder: {}", parent_path.string()) << endl;
+                return {};
+            }
+        }
+
+        return output_file;
+    };
+
     if ((command == "list") || (command == "ls")) {
         auto pak = parse_pak();
         if (!pak)
@@ -123,12 +329,79 @@ int main(int, char* argv[]) {
         return 0;
     }
 
+    if (command == "cat") {
+        auto pak = parse_pak();
+        if (!pak)
+            return -1;
+
+        if (output.empty()) {
+            cerr << "no item set" << endl;
+            return -1;
+        }
+
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+        if ((paker.parameters.offset > 0) || (paker.parameters.length >= 0)) {
+            buffer_pool::buffer data;
+            if (!paker.read(pak, input, output, paker.parameters.offset, paker.parameters.length, data)
+                || (std::fwrite(data.data(), 1, data.size(), stdout) != data.size())) {
+                cerr << "cannot cat" << endl;
+                return -1;
+            }
+
+            return 0;
+        }
+
+        if (!paker.cat(pak, input, output, stdout)) {
+            cerr << "cannot cat" << endl;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    if (command == "index") {
+        auto pak = parse_pak();
+        if (!pak)
+            return -1;
+
+        pak->map(input);
+
+        if (!paker.index(pak, input)) {
+            cerr << "cannot index" << endl;
+            return -1;
+        }
+
+        cout << format("ready: {}.zran", input) << endl;
+        return 0;
+    }
+
+    if ((command == "analyze") || (command == "a")) {
+        auto pak = parse_pak();
+        if (!pak)
+            return -1;
+
+        auto const output_file = prepare_output_file();
+        if (output_file.empty())
+            return -1;
+
+        if (!paker.analyze(pak, input, output_file)) {
+            cerr << "cannot analyze" << endl;
+            return -1;
+        }
+
+        cout << format("ready: {}", output_file.string()) << endl;
+        return 0;
+    }
+
     if ((command == "unpack") || (command == "u")) {
         auto pak = parse_pak();
         if (!pak)
             return -1;
 
-        auto const output_path = prepare_output_path(true);
+        auto const output_path = prepare_output_path(!paker.options.resume && !paker.options.sync);
         if (output_path.empty())
             return -1;
 
@@ -189,31 +462,96 @@ int main(int, char* argv[]) {
         return 0;
     }
 
-    auto prepare_output_file = [&]() -> fs::path {
-        if (output.empty()) {
-            cerr << "no output file set" << endl;
-            show_help();
-            return {};
+    if (command == "export") {
+        auto pak = parse_pak();
+        if (!pak)
+            return -1;
+
+        auto output_stream = stdout;
+        if (!output.empty() && (output != "-")) {
+            auto const output_file = prepare_output_file();
+            if (output_file.empty())
+                return -1;
+
+            output_stream = std::fopen(output_file.string().c_str(), "wb");
+            if (!output_stream) {
+                cerr << format("cannot write file: {}", output_file.string()) << endl;
+                return -1;
+            }
         }
 
-        fs::path const output_file = output;
-        auto const parent_path = output_file.parent_path();
-        if (!fs::exists(parent_path)) {
-            if (!fs::create_directories(parent_path)) {
-                cerr << format("cannot create folder: {}", parent_path.string()) << endl;
-                return {};
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+        bool const exported = paker.export_tar(pak, input, output_stream);
+        if (output_stream != stdout)
+            std::fclose(output_stream);
+
+        if (!exported) {
+            cerr << "cannot export" << endl;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    if (command == "import") {
+        auto const output_file = prepare_output_file();
+        if (output_file.empty())
+            return -1;
+
+        bool imported = false;
+        if (input == "-") {
+#ifdef _WIN32
+            _setmode(_fileno(stdin), _O_BINARY);
+#endif
+            imported = paker.import_tar(cin, output_file);
+        } else {
+            ifstream archive(input, ios::binary);
+            if (!archive) {
+                cerr << format("cannot read file: {}", input) << endl;
+                return -1;
             }
+            imported = paker.import_tar(archive, output_file);
         }
 
-        return output_file;
-    };
+        if (!imported) {
+            cerr << "cannot import" << endl;
+            return -1;
+        }
+
+        cout << "imported." << endl;
+        return 0;
+    }
+
+    if ((command == "build") || (command == "b")) {
+        fs::path const input_path = input;
+        if (input_path.empty() || !fs::is_directory(input_path)) {
+            cerr << "no folder set" << endl;
+            show_help();
+            return -1;
+        }
+
+        auto const output_file = prepare_output_file();
+        if (output_file.empty())
+            return -1;
+
+        if (!paker.build(input_path, output_file)) {
+            cerr << "cannot build" << endl;
+            return -1;
+        }
+
+        cout << "built." << endl;
+        return 0;
+    }
 
     if ((command == "compress") || (command == "c")) {
         auto const output_file = prepare_output_file();
         if (output_file.empty())
             return -1;
 
-        if (!compress_file(input, output_file)) {
+        if (!paker.compress(input, output_file)) {
             cerr << "cannot compress" << endl;
             return -1;
         }
@@ -260,6 +598,36 @@ int main(int, char* argv[]) {
         return 0;
     }
 
+    if ((command == "run") || (command == "r")) {
+        if (!paker.run(input)) {
+            cerr << "cannot run" << endl;
+            return -1;
+        }
+
+        cout << "done." << endl;
+        return 0;
+    }
+
+    if ((command == "watch") || (command == "w")) {
+        auto const output_file = prepare_output_file();
+        if (output_file.empty())
+            return -1;
+
+        fs::path const mod_path = cmd_line[4];
+        if (mod_path.empty() || !fs::is_directory(mod_path)) {
+            cerr << "no folder set" << endl;
+            show_help();
+            return -1;
+        }
+
+        if (!paker.watch(input, output_file, mod_path)) {
+            cerr << "cannot watch" << endl;
+            return -1;
+        }
+
+        return 0;
+    }
+
     show_help();
     return -1;
 }
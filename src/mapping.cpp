@@ -0,0 +1,78 @@
+#include "mapping.hpp"
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace pl {
+
+//-----------------------------------------------------------------------------
+mapped_file::ptr mapped_file::open(fs::path const& file) {
+    auto result = std::make_shared<mapped_file>();
+
+#ifdef _WIN32
+    auto const handle = CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || (size.QuadPart == 0)) {
+        CloseHandle(handle);
+        return nullptr;
+    }
+
+    result->mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(handle);
+    if (!result->mapping)
+        return nullptr;
+
+    result->view = MapViewOfFile(result->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!result->view)
+        return nullptr;
+
+    result->length = size_t(size.QuadPart);
+#else
+    auto const fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat info;
+    if ((fstat(fd, &info) != 0) || (info.st_size == 0)) {
+        close(fd);
+        return nullptr;
+    }
+
+    auto const view = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+        return nullptr;
+
+    result->view = view;
+    result->length = size_t(info.st_size);
+#endif
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+mapped_file::~mapped_file() {
+#ifdef _WIN32
+    if (view)
+        UnmapViewOfFile(view);
+    if (mapping)
+        CloseHandle(mapping);
+#else
+    if (view)
+        munmap(view, length);
+#endif
+}
+
+} // namespace pl
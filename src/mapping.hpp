@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+
+namespace pl {
+
+namespace fs = std::filesystem;
+
+// read-only view of a whole file, shared between commands
+struct mapped_file {
+    using ptr = std::shared_ptr<mapped_file>;
+
+    static ptr open(fs::path const& file); // nullptr if not mappable
+
+    mapped_file() = default;
+    ~mapped_file();
+
+    mapped_file(mapped_file const&) = delete;
+    mapped_file& operator=(mapped_file const&) = delete;
+
+    char const* data() const {
+        return static_cast<char const*>(view);
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    bool contains(int64_t offset, int64_t size) const {
+        return (offset >= 0) && (size >= 0) && (size_t(offset + size) <= length);
+    }
+
+private:
+    void* view = nullptr;
+    size_t length = 0;
+
+#ifdef _WIN32
+    void* mapping = nullptr;
+#endif
+};
+
+} // namespace pl
@@ -1,18 +1,76 @@
 #include "paker.hpp"
+#include "checkpoint.hpp"
+#include "layout.hpp"
+#include "mapping.hpp"
 #include "nlohmann/json.hpp"
+#include "tar.hpp"
+#include "trace.hpp"
+#include "watcher.hpp"
+#include "writer.hpp"
 #include "zlib.h"
-#include <climits>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <format>
 #include <fstream>
+#include <future>
+#include <map>
+#include <semaphore>
+#include <set>
+#include <spanstream>
+#include <thread>
+
+#if defined(__linux__)
+    #include <fcntl.h>
+    #include <sys/sendfile.h>
+    #include <unistd.h>
+    #define PLPAK_SENDFILE 1
+#endif
 
 namespace pl {
 using json = nlohmann::json;
+using clock = std::chrono::steady_clock;
 
 const char plpaker_version[] = "0.12.0";
 
 const char compressed_extension[] = ".comp";
 const char pakinfo_json[] = "pakinfo.json";
+const char unpack_journal[] = ".unpack.journal";
+const char pakchanges_json[] = "pakchanges.json";
+const char checkpoint_extension[] = ".zran";
+
+constexpr size_t stream_chunk_size = 1 << 20; // large items
+constexpr size_t journal_batch = 256;          // items per journal flush
+
+constexpr size_t parallel_block_size = 1 << 20;                  // deflate per worker
+constexpr size_t parallel_min_size = 4 * parallel_block_size;    // below one stream wins
+constexpr size_t deflate_window = 32 << 10;                      // dictionary between blocks
+constexpr int64_t deflate_max_ratio = 1032;                      // output per input byte, at most
+
+using data_sink = std::function<bool(char const*, size_t)>;
+
+constexpr std::chrono::milliseconds watch_debounce(200); // change bursts
+
+constexpr size_t store_sample_size = 64 << 10; // --auto-store, begin/middle/end
+constexpr double store_entropy = 7.9;           // --auto-store, bits/byte stored untried
+
+// analyze: compression that barely pays for its decode time
+constexpr double analyze_min_saving = 0.1;
+constexpr std::chrono::microseconds analyze_min_decode(100);
+
+// --best tries these besides the start settings
+compression_settings const best_candidates[] = {
+    {9, Z_DEFAULT_STRATEGY, 9},
+    {9, Z_FILTERED, 9},
+    {9, Z_RLE, 9},
+    {9, Z_DEFAULT_STRATEGY, 8},
+    {8, Z_FILTERED, 9},
+    {6, Z_DEFAULT_STRATEGY, 9},
+};
 
 struct scope_data {
     explicit scope_data(size_t size) {
@@ -26,37 +84,17 @@ struct scope_data {
     char* ptr = nullptr;
 };
 
-uint32_t to_uint_be(char* c) {
-    return uint32_t((unsigned char)(c[0]) << 24
-                    | (unsigned char)(c[1]) << 16
-                    | (unsigned char)(c[2]) << 8
-                    | (unsigned char)(c[3]));
-}
-
-uint32_t to_uint_le(char* c) {
-    return uint32_t((unsigned char)(c[3]) << 24
-                    | (unsigned char)(c[2]) << 16
-                    | (unsigned char)(c[1]) << 8
-                    | (unsigned char)(c[0]));
-}
-
-// https://stackoverflow.com/questions/105252/how-do-i-convert-between-big-endian-and-little-endian-values-in-c
-template <typename T>
-T swap_endian(T u) {
-    static_assert(CHAR_BIT == 8, "CHAR_BIT != 8");
+// on-disk index, read and written from the same description
+using index_header = layout::record<layout::field<&pak::version>,
+                                    layout::field<&pak::count>>;
 
-    union {
-        T u;
-        unsigned char u8[sizeof(T)];
-    } source, dest;
+using index_entry = layout::record<layout::field<&pak::item::compressed>,
+                                   layout::name_field<&pak::item::filename>,
+                                   layout::field<&pak::item::begin>,
+                                   layout::field<&pak::item::size>>;
 
-    source.u = u;
-
-    for (size_t k = 0; k < sizeof(T); k++)
-        dest.u8[k] = source.u8[sizeof(T) - k - 1];
-
-    return dest.u;
-}
+using index_footer = layout::record<layout::field<&pak::crc_value>,
+                                    layout::field<&pak::index_begin>>;
 
 //-----------------------------------------------------------------------------
 bool pak::parse(fs::path const& pak_file) {
@@ -66,64 +104,74 @@ bool pak::parse(fs::path const& pak_file) {
 
     file.seekg(0, file.end);
     length = file.tellg();
-    file.seekg(0, file.beg);
 
-    crc_pos = length - sizeof(index_begin) - sizeof(crc_value);
-    file.seekg(crc_pos);
-    file.read((char*)&crc_value, sizeof(crc_value));
+    if (length < int64_t(index_footer::fixed_size))
+        return false;
 
+    crc_pos = length - index_footer::fixed_size;
     index_pos = length - sizeof(index_begin);
-    file.seekg(index_pos);
-    file.read((char*)&index_begin, sizeof(index_begin));
-
-    file.seekg(index_begin);
-    file.read((char*)&version, sizeof(version));
-    file.read((char*)&count, sizeof(count));
 
-    for (auto index = 0u; index < count; ++index) {
-        pak::item item;
-        item.index = index;
-        item.pos = file.tellg();
+    char footer[index_footer::fixed_size];
+    file.seekg(crc_pos);
+    file.read(footer, sizeof(footer));
+    index_footer::read(footer, footer + sizeof(footer), *this);
 
-        file.read((char*)&item.compressed, sizeof(item.compressed));
+    if ((index_begin < 0) || (uint64_t(index_begin) > crc_pos))
+        return false;
 
-        char str_length_bytes[4];
-        file.read(str_length_bytes, sizeof(str_length_bytes));
-        auto str_length = to_uint_be(str_length_bytes);
+    // whole index at once
+    std::vector<char> index(crc_pos - index_begin);
+    file.seekg(index_begin);
+    file.read(index.data(), index.size());
+    if (!file)
+        return false;
 
-        {
-            int64_t const filename_pos = file.tellg();
+    auto const index_end = index.data() + index.size();
+    auto pos = index_header::read(index.data(), index_end, *this);
 
-            char filename[256];
-            file.read(filename, str_length);
+    for (auto i = 0; pos && (i < count); ++i) {
+        pak::item item;
+        item.index = i;
+        item.pos = index_begin + (pos - index.data());
 
-            if (filename[0] == 1) { // 128+ offset
-                file.seekg(filename_pos + 1);
-                file.read(filename, str_length);
-            }
+        pos = index_entry::read(pos, index_end, item);
+        if (!pos)
+            break;
 
-            filename[str_length] = '\0';
-            item.filename = filename;
-        }
+        max_size = std::max(max_size, item.size);
 
-        file.read((char*)&item.begin, sizeof(item.begin));
-        file.read((char*)&item.size, sizeof(item.size));
+        items.push_back(std::move(item));
+    }
 
-        max_size = std::max(max_size, item.size);
+    if (!pos)
+        return false;
 
-        if (index != 0) // skip first
-            items.at(index - 1).end = item.begin;
+    // next item in file order, watch may append items out of order; the slots it
+    // frees are zeroed and end up as padding of the item before
+    std::vector<item*> order;
+    for (auto& item : items)
+        order.push_back(&item);
 
-        items.push_back(std::move(item));
+    // empty stored items share their begin with the next one and come first
+    auto const empty = [](item const* i) {
+        return !i->compressed && (i->size == 0);
     };
+    std::stable_sort(order.begin(), order.end(), [&](item const* a, item const* b) {
+        return (a->begin < b->begin) || ((a->begin == b->begin) && empty(a) && !empty(b));
+    });
 
-    // last before index
-    items.at(count - 1).end = index_begin;
+    for (auto i = 0u; i < order.size(); ++i)
+        order[i]->end = (i + 1 < order.size()) ? order[i + 1]->begin : index_begin;
 
-    file.close();
     return true;
 }
 
+//-----------------------------------------------------------------------------
+bool pak::map(fs::path const& pak_file) {
+    mapping = mapped_file::open(pak_file);
+    return mapping != nullptr;
+}
+
 //-----------------------------------------------------------------------------
 bool pak::load(fs::path const& pakinfo_file) {
     std::ifstream file(pakinfo_file, std::ios::binary);
@@ -185,6 +233,19 @@ bool pak::load(fs::path const& pakinfo_file) {
             if (j_item.count("size_compressed"))
                 item.size_compressed = j_item["size_compressed"];
 
+            if (j_item.count("best")) {
+                auto const& j_best = j_item["best"];
+
+                compression_settings best;
+                if (j_best.count("level"))
+                    best.level = j_best["level"];
+                if (j_best.count("strategy"))
+                    best.strategy = j_best["strategy"];
+                if (j_best.count("mem_level"))
+                    best.mem_level = j_best["mem_level"];
+                item.best = best;
+            }
+
             items.push_back(std::move(item));
         }
     }
@@ -210,6 +271,14 @@ bool pak::write_info(fs::path const& output_path) const {
     if (!file)
         return false;
 
+    auto const j_string = info();
+    file.write(j_string.data(), j_string.size());
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+string pak::info() const {
     auto j_files = json::array();
     for (auto const& item : items) {
         json j_file;
@@ -224,6 +293,14 @@ bool pak::write_info(fs::path const& output_path) const {
         if (item.size_compressed > 0)
             j_file["size_compressed"] = item.size_compressed;
 
+        if (item.best) {
+            json j_best;
+            j_best["level"] = item.best->level;
+            j_best["strategy"] = item.best->strategy;
+            j_best["mem_level"] = item.best->mem_level;
+            j_file["best"] = j_best;
+        }
+
         j_files.push_back(j_file);
     }
 
@@ -242,38 +319,444 @@ bool pak::write_info(fs::path const& output_path) const {
     j["count"] = count;
     j["files"] = j_files;
 
-    auto const j_string = j.dump(4);
-    file.write(j_string.data(), j_string.size());
+    return j.dump(4);
+}
 
-    return true;
+//-----------------------------------------------------------------------------
+size_t compress_bound(size_t size) {
+    return compressBound(size) + 18; // gzip header/trailer
 }
 
 //-----------------------------------------------------------------------------
-bool compress_data(char* const decompressed_data, size_t& decompressed_data_size,
-                   char* compressed_data, size_t& compressed_data_size) {
+uLong update_crc(uLong crc, char const* data, size_t size) {
+    trace::span span("crc");
+    return crc32(crc, reinterpret_cast<const Bytef*>(data), size);
+}
+
+//-----------------------------------------------------------------------------
+bool read_data(std::istream& input, char* data, size_t size) {
+    trace::span span("read");
+    return bool(input.read(data, size));
+}
+
+//-----------------------------------------------------------------------------
+bool write_data(std::ostream& output, char const* data, size_t size) {
+    trace::span span("write");
+    return bool(output.write(data, size));
+}
+
+//-----------------------------------------------------------------------------
+bool copy_stream(std::istream& input, int64_t size,
+                 std::ostream& output, buffer_pool& buffers, uLong* crc = nullptr) {
+    trace::span span("copy stream");
+
+    auto chunk = buffers.acquire(stream_chunk_size);
+
+    while (size > 0) {
+        auto const chunk_size = std::min<int64_t>(size, chunk.size());
+        if (!input.read(chunk.data(), chunk_size))
+            return false;
+
+        output.write(chunk.data(), chunk_size);
+        if (crc)
+            *crc = update_crc(*crc, chunk.data(), chunk_size);
+
+        size -= chunk_size;
+    }
+
+    return bool(output);
+}
+
+//-----------------------------------------------------------------------------
+bool deflate_stream(std::istream& input, std::ostream& output, buffer_pool& buffers,
+                    int64_t& decompressed_size, int64_t& compressed_size,
+                    compression_settings const& settings = {}, uLong* crc = nullptr,
+                    int64_t size = -1) { // to the end if negative
+    trace::span span("deflate stream");
+
     z_stream stream = {0};
     stream.zalloc = Z_NULL;
     stream.zfree = Z_NULL;
     stream.opaque = Z_NULL;
 
     auto res = deflateInit2(&stream,
-                            Z_DEFAULT_COMPRESSION,
+                            settings.level,
                             Z_DEFLATED,
                             31,
-                            8,
-                            Z_DEFAULT_STRATEGY);
+                            settings.mem_level,
+                            settings.strategy);
+    if (res < 0)
+        return false;
+
+    auto chunk_in = buffers.acquire(stream_chunk_size);
+    auto chunk_out = buffers.acquire(stream_chunk_size);
+
+    auto flush = Z_NO_FLUSH;
+    do {
+        input.read(chunk_in.data(), (size < 0) ? chunk_in.size() : std::min<int64_t>(size, chunk_in.size()));
+        if (input.bad()) {
+            deflateEnd(&stream);
+            return false;
+        }
+
+        if (size > 0)
+            size -= input.gcount();
+
+        flush = (input.eof() || (size == 0)) ? Z_FINISH : Z_NO_FLUSH;
+        stream.avail_in = input.gcount();
+        stream.next_in = reinterpret_cast<unsigned char*>(chunk_in.data());
+
+        do {
+            stream.avail_out = chunk_out.size();
+            stream.next_out = reinterpret_cast<unsigned char*>(chunk_out.data());
+
+            res = deflate(&stream, flush);
+            if (res == Z_STREAM_ERROR) {
+                deflateEnd(&stream);
+                return false;
+            }
+
+            auto const have = chunk_out.size() - stream.avail_out;
+            output.write(chunk_out.data(), have);
+            if (crc)
+                *crc = update_crc(*crc, chunk_out.data(), have);
+        } while (stream.avail_out == 0);
+    } while (flush != Z_FINISH);
+
+    decompressed_size = stream.total_in;
+    compressed_size = stream.total_out;
+
+    deflateEnd(&stream);
+    return (res == Z_STREAM_END) && output;
+}
+
+//-----------------------------------------------------------------------------
+bool parallel_deflate(worker_pool const& workers, size_t size) {
+    return (workers.size() > 1) && (size >= parallel_min_size);
+}
+
+//-----------------------------------------------------------------------------
+// pigz-style: blocks deflated on all workers, each primed with the 32 KB before it,
+// joined in order into one gzip member
+bool deflate_parallel(std::istream& input, data_sink const& output, worker_pool& workers, buffer_pool& buffers,
+                      int64_t& decompressed_size, int64_t& compressed_size,
+                      compression_settings const& settings = {}) {
+    struct block {
+        buffer_pool::buffer in; // dictionary + data
+        buffer_pool::buffer out;
+        size_t dictionary = 0;
+        size_t size = 0;
+        bool last = false;
+
+        uLong crc = 0;
+        bool valid = false;
+
+        std::unique_ptr<worker_pool::group> task;
+    };
+    std::deque<block> blocks;
+
+    // same extra flags as zlib
+    auto const level = (settings.level == Z_DEFAULT_COMPRESSION) ? 6 : settings.level;
+    unsigned char const extra = (level == 9) ? 2 : ((level < 2) || (settings.strategy >= Z_HUFFMAN_ONLY)) ? 4 : 0;
+
+    unsigned char const header[10] = {0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, extra, 3}; // unix
+    if (!output(reinterpret_cast<char const*>(header), sizeof(header)))
+        return false;
+
+    decompressed_size = 0;
+    compressed_size = sizeof(header);
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    bool failed = false;
+
+    // oldest block out, false if none in flight
+    auto const write_block = [&]() {
+        if (blocks.empty())
+            return false;
+
+        auto& b = blocks.front();
+        {
+            trace::span span("deflate wait");
+            b.task->wait();
+        }
+
+        if (!b.valid || !output(b.out.data(), b.out.size()))
+            failed = true;
+
+        crc = crc32_combine(crc, b.crc, b.size);
+        decompressed_size += b.size;
+        compressed_size += b.out.size();
+
+        blocks.pop_front();
+        return true;
+    };
+
+    auto const max_blocks = 2 * workers.size();
+
+    char window[deflate_window]; // end of the previous block
+    size_t window_size = 0;
+
+    for (bool last = false; !last && !failed;) {
+        while (blocks.size() >= max_blocks)
+            write_block();
+
+        block b;
+        b.in = buffers.acquire(window_size + parallel_block_size, write_block);
+        b.out = buffers.acquire(compress_bound(parallel_block_size) + 64, write_block);
+
+        b.dictionary = window_size;
+        std::memcpy(b.in.data(), window, window_size);
+
+        input.read(b.in.data() + b.dictionary, parallel_block_size);
+        if (input.bad())
+            failed = true;
+
+        b.size = input.gcount();
+        b.last = last = (input.peek() == std::char_traits<char>::eof());
+
+        auto const next_window = std::min(b.dictionary + b.size, deflate_window);
+        std::memcpy(window, b.in.data() + b.dictionary + b.size - next_window, next_window);
+        window_size = next_window;
+
+        blocks.push_back(std::move(b));
+
+        auto& queued = blocks.back();
+        queued.task = std::make_unique<worker_pool::group>(workers);
+        queued.task->run([&b = queued, settings]() {
+            trace::span span("deflate block");
+
+            auto const data = reinterpret_cast<unsigned char*>(b.in.data());
+            b.crc = update_crc(crc32(0L, Z_NULL, 0), b.in.data() + b.dictionary, b.size);
+
+            z_stream stream = {0};
+            stream.zalloc = Z_NULL;
+            stream.zfree = Z_NULL;
+            stream.opaque = Z_NULL;
+
+            auto res = deflateInit2(&stream, settings.level, Z_DEFLATED, -15, settings.mem_level, settings.strategy);
+            if (res < 0)
+                return;
+
+            if (b.dictionary)
+                deflateSetDictionary(&stream, data, b.dictionary);
+
+            stream.avail_in = b.size;
+            stream.next_in = data + b.dictionary;
+            stream.avail_out = b.out.size();
+            stream.next_out = reinterpret_cast<unsigned char*>(b.out.data());
+
+            // byte aligned end, the next block continues the stream
+            res = deflate(&stream, b.last ? Z_FINISH : Z_SYNC_FLUSH);
+            b.valid = (stream.avail_in == 0) && (stream.avail_out > 0) && (b.last ? (res == Z_STREAM_END) : (res == Z_OK));
+
+            b.out.resize(stream.total_out);
+            deflateEnd(&stream);
+        });
+    }
+
+    while (write_block())
+        ;
+
+    if (failed)
+        return false;
+
+    unsigned char trailer[8];
+    for (auto i = 0; i < 4; ++i) {
+        trailer[i] = (crc >> (8 * i)) & 0xff;
+        trailer[4 + i] = (uint64_t(decompressed_size) >> (8 * i)) & 0xff;
+    }
+
+    compressed_size += sizeof(trailer);
+    return output(reinterpret_cast<char const*>(trailer), sizeof(trailer));
+}
+
+//-----------------------------------------------------------------------------
+bool inflate_stream(std::istream& input, int64_t size, data_sink const& output, buffer_pool& buffers,
+                    int64_t& compressed_size, int64_t& decompressed_size, std::ostream* input_copy = nullptr) {
+    trace::span span("inflate stream");
+
+    z_stream stream = {0};
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    auto res = inflateInit2(&stream, 31);
     if (res < 0)
         return false;
 
-    stream.avail_in = decompressed_data_size;
-    stream.next_in = reinterpret_cast<unsigned char*>(decompressed_data);
+    auto chunk_in = buffers.acquire(stream_chunk_size);
+    auto chunk_out = buffers.acquire(stream_chunk_size);
+
+    while (res != Z_STREAM_END) {
+        if (stream.avail_in == 0) {
+            if (size == 0) // truncated
+                break;
+
+            auto const chunk_size = std::min<int64_t>(size, chunk_in.size());
+            if (!input.read(chunk_in.data(), chunk_size))
+                break;
+
+            if (input_copy)
+                input_copy->write(chunk_in.data(), chunk_size);
+
+            stream.avail_in = chunk_size;
+            stream.next_in = reinterpret_cast<unsigned char*>(chunk_in.data());
+            size -= chunk_size;
+        }
+
+        stream.avail_out = chunk_out.size();
+        stream.next_out = reinterpret_cast<unsigned char*>(chunk_out.data());
+
+        res = inflate(&stream, Z_NO_FLUSH);
+        if ((res == Z_NEED_DICT) || (res == Z_DATA_ERROR) || (res == Z_MEM_ERROR) || (res == Z_STREAM_ERROR))
+            break;
+
+        if (!output(chunk_out.data(), chunk_out.size() - stream.avail_out)) {
+            res = Z_ERRNO;
+            break;
+        }
+    }
+
+    compressed_size = stream.total_in;
+    decompressed_size = stream.total_out;
+
+    inflateEnd(&stream);
+    return (res == Z_STREAM_END) && (!input_copy || *input_copy);
+}
+
+//-----------------------------------------------------------------------------
+bool inflate_stream(std::istream& input, int64_t size, std::ostream& output, buffer_pool& buffers,
+                    int64_t& compressed_size, int64_t& decompressed_size, std::ostream* input_copy = nullptr) {
+    auto const sink = [&](char const* data, size_t data_size) {
+        return bool(output.write(data, data_size));
+    };
+
+    return inflate_stream(input, size, sink, buffers, compressed_size, decompressed_size, input_copy);
+}
+
+//-----------------------------------------------------------------------------
+// absolute item addresses, from the mapping if there is one
+std::unique_ptr<std::istream> open_data(pak const& pak, fs::path const& pak_file) {
+    if (pak.mapping)
+        return std::make_unique<std::ispanstream>(std::span<char const>(pak.mapping->data(), pak.mapping->size()));
+
+    return std::make_unique<std::ifstream>(pak_file, std::ios::binary);
+}
+
+//-----------------------------------------------------------------------------
+// gzip item without the zeros of an aligned slot: the stream ends with the item
+// size modulo 4 GB, only inflated to find its end if that leaves it open
+int64_t gzip_size(std::istream& input, int64_t begin, int64_t size, int64_t decompressed_size) {
+    auto const isize = uint32_t(decompressed_size);
+
+    auto high_zeros = 0; // trailer bytes after its last non-zero one
+    while ((high_zeros < 4) && !((isize >> (8 * (3 - high_zeros))) & 0xff))
+        ++high_zeros;
+
+    char chunk[4096];
+    for (auto end = size; (high_zeros < 4) && (end > 0);) {
+        auto const chunk_size = std::min<int64_t>(end, sizeof(chunk));
+        input.seekg(begin + end - chunk_size);
+        if (!input.read(chunk, chunk_size))
+            break;
+
+        auto last = chunk_size;
+        while ((last > 0) && (chunk[last - 1] == 0))
+            --last;
+
+        end -= chunk_size;
+        if (last == 0)
+            continue; // padding
+
+        auto const length = end + last + high_zeros;
+        if (length > size)
+            break;
+
+        unsigned char trailer[4];
+        input.seekg(begin + length - 4);
+        if (!input.read(reinterpret_cast<char*>(trailer), sizeof(trailer)))
+            break;
+
+        if ((trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (uint32_t(trailer[3]) << 24)) == isize)
+            return length;
+        break;
+    }
+
+    input.clear();
+    input.seekg(begin);
+
+    z_stream stream = {0};
+    if (inflateInit2(&stream, 31) < 0)
+        return size;
+
+    char chunk_out[16384];
+    auto res = Z_OK;
+    while ((res == Z_OK) || (res == Z_BUF_ERROR)) {
+        if (stream.avail_in == 0) {
+            auto const chunk_size = std::min<int64_t>(size - stream.total_in, sizeof(chunk));
+            if ((chunk_size <= 0) || !input.read(chunk, chunk_size))
+                break;
+
+            stream.avail_in = chunk_size;
+            stream.next_in = reinterpret_cast<unsigned char*>(chunk);
+        }
+
+        stream.avail_out = sizeof(chunk_out);
+        stream.next_out = reinterpret_cast<unsigned char*>(chunk_out);
+        res = inflate(&stream, Z_NO_FLUSH);
+    }
+
+    auto const length = (res == Z_STREAM_END) ? int64_t(stream.total_in) : size;
+    inflateEnd(&stream);
+    return length;
+}
+
+//-----------------------------------------------------------------------------
+bool deflate_data(char* const decompressed_data, size_t& decompressed_data_size,
+                  char* compressed_data, size_t& compressed_data_size,
+                  compression_settings const& settings, clock::time_point const* deadline) {
+    trace::span span("deflate");
+
+    z_stream stream = {0};
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+
+    auto res = deflateInit2(&stream,
+                            settings.level,
+                            Z_DEFLATED,
+                            31,
+                            settings.mem_level,
+                            settings.strategy);
+    if (res < 0)
+        return false;
 
     stream.avail_out = compressed_data_size;
     stream.next_out = reinterpret_cast<unsigned char*>(compressed_data);
 
-    res = deflate(&stream, Z_FINISH);
-    if (res < 0)
+    auto next = reinterpret_cast<unsigned char*>(decompressed_data);
+    auto remaining = decompressed_data_size;
+
+    // slices to check the deadline in between
+    auto const slice_size = deadline ? stream_chunk_size : remaining;
+    do {
+        auto const size = std::min(remaining, slice_size);
+        stream.avail_in = size;
+        stream.next_in = next;
+
+        next += size;
+        remaining -= size;
+
+        res = deflate(&stream, remaining ? Z_NO_FLUSH : Z_FINISH);
+        if ((res == Z_STREAM_ERROR) || (stream.avail_in != 0) || (deadline && (clock::now() > *deadline))) {
+            deflateEnd(&stream);
+            return false;
+        }
+    } while (remaining > 0);
+
+    if (res != Z_STREAM_END) { // output too small
+        deflateEnd(&stream);
         return false;
+    }
 
     compressed_data_size = stream.total_out;
 
@@ -284,33 +767,27 @@ bool compress_data(char* const decompressed_data, size_t& decompressed_data_size
     return true;
 }
 
+//-----------------------------------------------------------------------------
+bool compress_data(char* const decompressed_data, size_t& decompressed_data_size,
+                   char* compressed_data, size_t& compressed_data_size,
+                   compression_settings const& settings) {
+    return deflate_data(decompressed_data,
+                        decompressed_data_size,
+                        compressed_data,
+                        compressed_data_size,
+                        settings,
+                        nullptr);
+}
+
 //-----------------------------------------------------------------------------
 bool compress_file(fs::path const& input_file,
-                   fs::path const& output_file) {
+                   fs::path const& output_file,
+                   compression_settings const& settings,
+                   worker_pool* workers) {
     std::ifstream decompressed_file(input_file, std::ios::binary);
     if (!decompressed_file)
         return false;
 
-    decompressed_file.seekg(0, decompressed_file.end);
-    size_t decompressed_size = decompressed_file.tellg();
-    decompressed_file.seekg(0, decompressed_file.beg);
-
-    int64_t const max_data_size = std::pow(2, std::ceil(std::log2(decompressed_size)));
-
-    scope_data decompressed_data(max_data_size);
-
-    decompressed_file.read(decompressed_data.ptr, decompressed_size);
-    decompressed_file.close();
-
-    scope_data compressed_data(max_data_size);
-    size_t compressed_data_size = max_data_size;
-
-    if (!compress_data(decompressed_data.ptr,
-                       decompressed_size,
-                       compressed_data.ptr,
-                       compressed_data_size))
-        return false;
-
     if (fs::exists(output_file))
         fs::remove(output_file);
 
@@ -318,7 +795,36 @@ bool compress_file(fs::path const& input_file,
     if (!compressed_file)
         return false;
 
-    compressed_file.write(compressed_data.ptr, compressed_data_size);
+    buffer_pool buffers;
+    int64_t decompressed_size = 0;
+    int64_t compressed_size = 0;
+
+    std::error_code ec;
+    if (workers && parallel_deflate(*workers, fs::file_size(input_file, ec))) {
+        auto const sink = [&](char const* data, size_t data_size) {
+            return bool(compressed_file.write(data, data_size));
+        };
+
+        if (!deflate_parallel(decompressed_file,
+                              sink,
+                              *workers,
+                              buffers,
+                              decompressed_size,
+                              compressed_size,
+                              settings))
+            return false;
+
+        compressed_file.close();
+        return bool(compressed_file);
+    }
+
+    if (!deflate_stream(decompressed_file,
+                        compressed_file,
+                        buffers,
+                        decompressed_size,
+                        compressed_size,
+                        settings))
+        return false;
 
     compressed_file.close();
     return true;
@@ -327,6 +833,8 @@ bool compress_file(fs::path const& input_file,
 //-----------------------------------------------------------------------------
 bool decompress_data(char* const compressed_data, size_t& compressed_data_size,
                      char* decompressed_data, size_t& decompressed_data_size) {
+    trace::span span("inflate");
+
     z_stream stream = {0};
     stream.zalloc = Z_NULL;
     stream.zfree = Z_NULL;
@@ -345,6 +853,7 @@ bool decompress_data(char* const compressed_data, size_t& compressed_data_size,
     if (res < 0)
         return false;
 
+    compressed_data_size = stream.total_in; // without padding
     decompressed_data_size = stream.total_out;
 
     res = inflateEnd(&stream);
@@ -355,34 +864,51 @@ bool decompress_data(char* const compressed_data, size_t& compressed_data_size,
 }
 
 //-----------------------------------------------------------------------------
-bool decompress_file(fs::path const& input_file,
-                     fs::path const& output_file) {
-    std::ifstream compressed_file(input_file, std::ios::binary);
-    if (!compressed_file)
+// compressed data inflates back to exactly data, compared piece by piece
+bool inflates_to(char const* compressed_data, size_t compressed_data_size,
+                 char const* data, size_t data_size) {
+    z_stream stream = {0};
+    if (inflateInit2(&stream, 31) < 0)
         return false;
 
-    compressed_file.seekg(0, compressed_file.end);
-    size_t const compressed_size = compressed_file.tellg();
-    compressed_file.seekg(0, compressed_file.beg);
+    stream.avail_in = compressed_data_size;
+    stream.next_in = reinterpret_cast<unsigned char*>(const_cast<char*>(compressed_data)); // zlib without ZLIB_CONST
 
-    scope_data compressed_data(compressed_size);
+    std::vector<char> chunk(deflate_window);
+    size_t checked = 0;
 
-    compressed_file.read(compressed_data.ptr, compressed_size);
-    compressed_file.close();
+    auto res = Z_OK;
+    while (res == Z_OK) {
+        stream.avail_out = chunk.size();
+        stream.next_out = reinterpret_cast<unsigned char*>(chunk.data());
 
-    size_t compressed_data_size = compressed_size;
+        res = inflate(&stream, Z_NO_FLUSH);
+        if ((res != Z_OK) && (res != Z_STREAM_END))
+            break;
 
-    int64_t const max_data_size = std::pow(2, std::ceil(std::log2(compressed_data_size * 2)));
+        auto const size = chunk.size() - stream.avail_out;
+        if ((checked + size > data_size) || (std::memcmp(chunk.data(), data + checked, size) != 0)) {
+            res = Z_DATA_ERROR;
+            break;
+        }
+        checked += size;
+    }
 
-    scope_data data_decompressed(max_data_size);
-    size_t decompressed_data_size = max_data_size;
+    inflateEnd(&stream);
+    return (res == Z_STREAM_END) && (checked == data_size);
+}
 
-    if (!decompress_data(compressed_data.ptr,
-                         compressed_data_size,
-                         data_decompressed.ptr,
-                         decompressed_data_size))
+//-----------------------------------------------------------------------------
+bool decompress_file(fs::path const& input_file,
+                     fs::path const& output_file) {
+    std::ifstream compressed_file(input_file, std::ios::binary);
+    if (!compressed_file)
         return false;
 
+    compressed_file.seekg(0, compressed_file.end);
+    int64_t const compressed_size = compressed_file.tellg();
+    compressed_file.seekg(0, compressed_file.beg);
+
     if (fs::exists(output_file))
         fs::remove(output_file);
 
@@ -390,53 +916,441 @@ bool decompress_file(fs::path const& input_file,
     if (!decompressed_file)
         return false;
 
-    decompressed_file.write(data_decompressed.ptr, decompressed_data_size);
+    buffer_pool buffers;
+    int64_t compressed_data_size = 0;
+    int64_t decompressed_data_size = 0;
+
+    if (!inflate_stream(compressed_file,
+                        compressed_size,
+                        decompressed_file,
+                        buffers,
+                        compressed_data_size,
+                        decompressed_data_size))
+        return false;
 
     decompressed_file.close();
     return true;
 }
 
 //-----------------------------------------------------------------------------
-void write_index(pak::ptr pak, std::ofstream& stream, uLong crc) {
-    int64_t const index_begin = stream.tellp();
-    stream.write(reinterpret_cast<const char*>(&pak->version), sizeof(pak->version));
-    crc = crc32(crc, reinterpret_cast<const Bytef*>(&pak->version), sizeof(pak->version));
-    stream.write(reinterpret_cast<const char*>(&pak->count), sizeof(pak->count));
-    crc = crc32(crc, reinterpret_cast<const Bytef*>(&pak->count), sizeof(pak->count));
-
-    for (auto const& item : pak->items) {
+bool write_file(std::FILE* output, char const* data, size_t size) {
+    return std::fwrite(data, 1, size, output) == size;
+}
 
-        stream.write(reinterpret_cast<const char*>(&item.compressed), sizeof(item.compressed));
-        crc = crc32(crc, reinterpret_cast<const Bytef*>(&item.compressed), sizeof(item.compressed));
+//-----------------------------------------------------------------------------
+bool send_file(std::FILE* output, fs::path const& input_file, int64_t offset, int64_t size, int64_t& sent) {
+    sent = 0;
+#ifdef PLPAK_SENDFILE
+    if (std::fflush(output) != 0)
+        return false;
 
-        auto const name_size = swap_endian<int32_t>(item.filename.size());
-        stream.write(reinterpret_cast<const char*>(&name_size), sizeof(name_size));
-        crc = crc32(crc, reinterpret_cast<const Bytef*>(&name_size), sizeof(name_size));
+    auto const input = open(input_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (input < 0)
+        return false;
 
-        if (item.filename.size() >= 128) {
-            bool const offset = true;
-            stream.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
-            crc = crc32(crc, reinterpret_cast<const Bytef*>(&offset), sizeof(offset));
+    off_t pos = offset;
+    while (sent < size) {
+        auto const res = sendfile(fileno(output), input, &pos, std::min<int64_t>(size - sent, 1 << 30));
+        if (res <= 0) {
+            if ((res < 0) && (errno == EINTR))
+                continue;
+            break;
         }
-
-        stream.write(item.filename.c_str(), item.filename.size());
-        crc = crc32(crc, reinterpret_cast<const Bytef*>(item.filename.c_str()), item.filename.size());
-
-        stream.write(reinterpret_cast<const char*>(&item.begin), sizeof(item.begin));
-        crc = crc32(crc, reinterpret_cast<const Bytef*>(&item.begin), sizeof(item.begin));
-        stream.write(reinterpret_cast<const char*>(&item.size), sizeof(item.size));
-        crc = crc32(crc, reinterpret_cast<const Bytef*>(&item.size), sizeof(item.size));
+        sent += res;
     }
 
-    pak->crc_value = crc;
-    stream.write(reinterpret_cast<const char*>(&pak->crc_value), sizeof(pak->crc_value));
-    stream.write(reinterpret_cast<const char*>(&index_begin), sizeof(index_begin));
+    close(input);
+    return sent == size;
+#else
+    (void)output;
+    (void)input_file;
+    (void)offset;
+    (void)size;
+    return false;
+#endif
 }
 
 //-----------------------------------------------------------------------------
-paker::paker()
-: version(plpaker_version) {
-}
+// zero copy if the kernel can, chunks for the rest
+bool send_range(std::FILE* output, fs::path const& input_file, int64_t offset, int64_t size, buffer_pool& buffers) {
+    int64_t sent = 0;
+    if (send_file(output, input_file, offset, size, sent))
+        return true;
+
+    std::ifstream file(input_file, std::ios::binary);
+    file.seekg(offset + sent);
+    size -= sent;
+
+    auto chunk = buffers.acquire(std::min<int64_t>(size, stream_chunk_size));
+    while (size > 0) {
+        auto const chunk_size = std::min<int64_t>(size, chunk.size());
+        if (!file.read(chunk.data(), chunk_size) || !write_file(output, chunk.data(), chunk_size))
+            return false;
+        size -= chunk_size;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+int64_t write_padding(std::ostream& output, uint32_t align, uLong& crc) {
+    if (align <= 1)
+        return 0;
+
+    int64_t const pos = output.tellp();
+    int64_t const padding = (align - pos % align) % align;
+
+    static char const zeros[4096] = {};
+    for (auto remaining = padding; remaining > 0;) {
+        auto const size = std::min<int64_t>(remaining, sizeof(zeros));
+        output.write(zeros, size);
+        crc = update_crc(crc, zeros, size);
+        remaining -= size;
+    }
+
+    return padding;
+}
+
+//-----------------------------------------------------------------------------
+void write_index(pak::ptr pak, std::ostream& stream, uLong crc) {
+    pak->index_begin = stream.tellp();
+
+    auto size = index_header::size(*pak);
+    for (auto const& item : pak->items)
+        size += index_entry::size(item);
+
+    std::vector<char> index(size + index_footer::fixed_size);
+
+    auto pos = index_header::write(index.data(), *pak);
+    for (auto const& item : pak->items)
+        pos = index_entry::write(pos, item);
+
+    pak->crc_value = update_crc(crc, index.data(), size);
+    index_footer::write(pos, *pak);
+
+    stream.write(index.data(), index.size());
+}
+
+//-----------------------------------------------------------------------------
+enum class file_state {
+    same,
+    changed,
+    missing,
+};
+
+//-----------------------------------------------------------------------------
+// existing file against new content, size first
+file_state compare_stream(std::istream& input, int64_t size, fs::path const& file, buffer_pool& buffers) {
+    std::error_code ec;
+    auto const file_size = fs::file_size(file, ec);
+    if (ec)
+        return file_state::missing;
+
+    if (file_size != uintmax_t(size))
+        return file_state::changed;
+
+    std::ifstream existing(file, std::ios::binary);
+    if (!existing)
+        return file_state::changed;
+
+    auto const chunk_size = std::min<int64_t>(size, stream_chunk_size);
+    auto chunk = buffers.acquire(chunk_size);
+    auto chunk_existing = buffers.acquire(chunk_size);
+
+    while (size > 0) {
+        auto const read_size = std::min<int64_t>(size, chunk_size);
+        if (!input.read(chunk.data(), read_size) || !existing.read(chunk_existing.data(), read_size))
+            return file_state::changed;
+
+        if (std::memcmp(chunk.data(), chunk_existing.data(), read_size) != 0)
+            return file_state::changed;
+
+        size -= read_size;
+    }
+
+    return file_state::same;
+}
+
+//-----------------------------------------------------------------------------
+// one chunk of the existing file against data in memory, reclaim while it waits
+file_state compare_data(char const* data,
+                        size_t size,
+                        fs::path const& file,
+                        buffer_pool& buffers,
+                        buffer_pool::reclaim_func const& reclaim) {
+    std::error_code ec;
+    auto const file_size = fs::file_size(file, ec);
+    if (ec)
+        return file_state::missing;
+
+    if (file_size != uintmax_t(size))
+        return file_state::changed;
+
+    std::ifstream existing(file, std::ios::binary);
+    if (!existing)
+        return file_state::changed;
+
+    auto chunk = buffers.acquire(std::min(size, stream_chunk_size), reclaim);
+
+    for (size_t offset = 0; offset < size;) {
+        auto const read_size = std::min(size - offset, stream_chunk_size);
+        if (!existing.read(chunk.data(), read_size) || (std::memcmp(chunk.data(), data + offset, read_size) != 0))
+            return file_state::changed;
+
+        offset += read_size;
+    }
+
+    return file_state::same;
+}
+
+//-----------------------------------------------------------------------------
+// * within a folder, ** across folders, ? one character
+bool glob_match(std::string_view pattern, std::string_view name) {
+    while (!pattern.empty()) {
+        if (pattern.starts_with("**")) {
+            pattern.remove_prefix(2);
+            for (auto i = 0u; i <= name.size(); ++i) {
+                if (glob_match(pattern, name.substr(i)))
+                    return true;
+            }
+            return false;
+        }
+
+        if (pattern[0] == '*') {
+            pattern.remove_prefix(1);
+            for (auto i = 0u; i <= name.size(); ++i) {
+                if (glob_match(pattern, name.substr(i)))
+                    return true;
+                if ((i < name.size()) && (name[i] == '/'))
+                    break;
+            }
+            return false;
+        }
+
+        if (name.empty() || ((pattern[0] != '?') && (pattern[0] != name[0])) || ((pattern[0] == '?') && (name[0] == '/')))
+            return false;
+
+        pattern.remove_prefix(1);
+        name.remove_prefix(1);
+    }
+
+    return name.empty();
+}
+
+//-----------------------------------------------------------------------------
+// build: first matching rule decides, patterns without a folder match the file name
+struct build_rule {
+    string match;
+    bool exclude = false;
+    bool compress = true;
+    std::optional<compression_settings> settings;
+};
+
+struct build_rules {
+    int32_t version = 1;     // of the rules format
+    int32_t pak_version = 0; // written to the pak
+    std::vector<build_rule> rules;
+
+    build_rule const* find(string const& filename) const {
+        auto const name = fs::path(filename).filename().string();
+
+        for (auto const& rule : rules) {
+            if (glob_match(rule.match, rule.match.contains('/') ? filename : name))
+                return &rule;
+        }
+        return nullptr;
+    }
+};
+
+//-----------------------------------------------------------------------------
+bool load_rules(fs::path const& rules_file, build_rules& result, string& error) {
+    std::ifstream file(rules_file, std::ios::binary);
+    if (!file) {
+        error = std::format("cannot read file: {}", rules_file.string());
+        return false;
+    }
+
+    string const data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!json::accept(data)) {
+        error = std::format("invalid rules: {}", rules_file.string());
+        return false;
+    }
+
+    auto const invalid = [&](json const& j_value) {
+        error = std::format("invalid rules: {}: {}", rules_file.string(), j_value.dump());
+        return false;
+    };
+
+    // missing keys take the defaults, wrong types are errors
+    auto const typed = [](json const& j_object, char const* key, bool (json::*is_type)() const noexcept) {
+        return !j_object.contains(key) || (j_object[key].*is_type)();
+    };
+
+    auto const j = json::parse(data);
+    if (!j.is_object()
+        || !typed(j, "version", &json::is_number_integer)
+        || !typed(j, "pak_version", &json::is_number_integer)
+        || !typed(j, "rules", &json::is_array))
+        return invalid(j);
+
+    if (j.value("version", result.version) != result.version) {
+        error = std::format("unsupported rules version: {}", j["version"].dump());
+        return false;
+    }
+
+    result.pak_version = j.value("pak_version", result.pak_version);
+
+    string_list const strategies = {"default", "filtered", "huffman", "rle", "fixed"};
+
+    auto const read_rule = [&](json const& j_rule, build_rule& rule) {
+        if (!j_rule.is_object()
+            || !typed(j_rule, "match", &json::is_string)
+            || !typed(j_rule, "exclude", &json::is_boolean)
+            || !typed(j_rule, "compress", &json::is_boolean)
+            || !typed(j_rule, "level", &json::is_number_integer))
+            return invalid(j_rule);
+
+        rule.match = j_rule.value("match", "**");
+        rule.exclude = j_rule.value("exclude", false);
+        rule.compress = j_rule.value("compress", true);
+
+        if (!j_rule.count("level") && !j_rule.count("strategy"))
+            return true;
+
+        compression_settings settings;
+        settings.level = j_rule.value("level", settings.level);
+        if ((settings.level < -1) || (settings.level > 9)) {
+            error = std::format("invalid level: {}", j_rule["level"].dump());
+            return false;
+        }
+
+        if (j_rule.count("strategy")) {
+            auto const& j_strategy = j_rule["strategy"];
+            if (j_strategy.is_number_integer()) {
+                settings.strategy = j_strategy;
+            } else if (!j_strategy.is_string()) {
+                return invalid(j_rule);
+            } else {
+                auto const it = std::find(strategies.begin(), strategies.end(), j_strategy.get<string>());
+                if (it == strategies.end()) {
+                    error = std::format("invalid strategy: {}", j_strategy.dump());
+                    return false;
+                }
+                settings.strategy = int(it - strategies.begin());
+            }
+        }
+
+        rule.settings = settings;
+        return true;
+    };
+
+    for (auto const& j_rule : j.value("rules", json::array())) {
+        build_rule rule;
+        if (!read_rule(j_rule, rule))
+            return false;
+        result.rules.push_back(std::move(rule));
+    }
+
+    // catch-all last
+    if (j.count("default")) {
+        build_rule rule;
+        if (!read_rule(j["default"], rule))
+            return false;
+        rule.match = "**";
+        result.rules.push_back(std::move(rule));
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+struct scanned_file {
+    string name; // relative, forward slashes
+    int64_t size = 0;
+};
+
+//-----------------------------------------------------------------------------
+// one task per folder, sorted by name afterwards, dangling links skipped
+std::vector<scanned_file> scan_tree(fs::path const& root, worker_pool& workers, string_list& errors) {
+    std::mutex mutex;
+    std::vector<scanned_file> result;
+
+    worker_pool::group tasks(workers);
+
+    std::function<void(fs::path const&)> scan = [&](fs::path const& folder) {
+        std::vector<scanned_file> files;
+        string_list folder_errors;
+
+        std::error_code ec;
+        for (fs::directory_iterator it(folder, ec), end; !ec && (it != end); it.increment(ec)) {
+            std::error_code ec_entry;
+            if (it->is_directory(ec_entry) && !it->is_symlink(ec_entry)) {
+                tasks.run([&, path = it->path()]() { scan(path); });
+            } else if (!ec_entry && it->is_regular_file(ec_entry)) {
+                auto const size = it->file_size(ec_entry);
+                if (!ec_entry)
+                    files.push_back({it->path().lexically_relative(root).generic_string(), int64_t(size)});
+            }
+
+            if (ec_entry && (ec_entry != std::errc::no_such_file_or_directory))
+                folder_errors.push_back(std::format("cannot read file: {} ({})", it->path().string(), ec_entry.message()));
+        }
+
+        if (ec)
+            folder_errors.push_back(std::format("cannot read folder: {} ({})", folder.string(), ec.message()));
+
+        std::lock_guard lock(mutex);
+        result.insert(result.end(), std::make_move_iterator(files.begin()), std::make_move_iterator(files.end()));
+        errors.insert(errors.end(), folder_errors.begin(), folder_errors.end());
+    };
+
+    scan(root);
+    tasks.wait();
+
+    std::sort(result.begin(), result.end(), [](scanned_file const& a, scanned_file const& b) {
+        return a.name < b.name;
+    });
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+// completed items of an earlier unpack: index, compressed size
+std::map<uint32_t, int64_t> read_journal(fs::path const& journal_file, pak const& pak) {
+    std::map<uint32_t, int64_t> result;
+
+    std::ifstream file(journal_file);
+    if (!file)
+        return result;
+
+    string header;
+    std::getline(file, header);
+    if (header != std::format("journal {} {}", pak.crc_value, pak.count))
+        return result; // other pak
+
+    // a torn last line is ignored
+    string line;
+    while (std::getline(file, line) && !file.eof()) {
+        auto const end = line.data() + line.size();
+
+        uint32_t index = 0;
+        auto const [pos, ec] = std::from_chars(line.data(), end, index);
+        if ((ec != std::errc()) || (pos == end) || (*pos != ' '))
+            continue;
+
+        int64_t size_compressed = 0;
+        auto const [size_pos, size_ec] = std::from_chars(pos + 1, end, size_compressed);
+        if ((size_ec == std::errc()) && (size_pos == end))
+            result[index] = size_compressed;
+    }
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+paker::paker()
+: version(plpaker_version), workers(worker_pool::create()), buffers(buffer_pool::create()) {
+}
 
 //-----------------------------------------------------------------------------
 bool paker::unpack(pak::ptr pak,
@@ -448,284 +1362,2866 @@ bool paker::unpack(pak::ptr pak,
         return false;
     }
 
-    int64_t const max_data_size = std::pow(2, std::ceil(std::log2(pak->max_size)));
+    auto const start_time = std::chrono::steady_clock::now();
+
+    // every folder once
+    std::set<fs::path> folders;
+    for (auto const& item : pak->items) {
+        if (!valid_parameter(item))
+            continue;
+
+        auto data_file = output_path;
+        data_file += fs::path::preferred_separator;
+        data_file += item.filename;
+
+        folders.insert(data_file.parent_path());
+    }
+
+    for (auto const& folder : folders) {
+        trace::span span("create_directories", folder);
+
+        std::error_code ec;
+        fs::create_directories(folder, ec);
+        if (ec) {
+            on_log_error(std::format("cannot create folder: {}", folder.string()));
+            return false;
+        }
+    }
+
+    auto journal_file = output_path;
+    journal_file += fs::path::preferred_separator;
+    journal_file += unpack_journal;
+
+    auto const done = options.resume ? read_journal(journal_file, *pak) : std::map<uint32_t, int64_t>();
+
+    std::ofstream journal(journal_file, done.empty() ? std::ios::trunc : std::ios::app);
+    if (!journal) {
+        on_log_error(std::format("cannot write file: {}", journal_file.string()));
+        return false;
+    }
+
+    if (done.empty())
+        journal << std::format("journal {} {}\n", pak->crc_value, pak->count) << std::flush;
+
+    auto const pak_data = open_data(*pak, pak_file); // .comp ends
+
+    auto writer = file_writer::create(workers);
+    auto const reclaim = [&]() { return writer->wait(); };
+
+    // written items only: an item is done once the writer finished all files
+    // queued up to it, the writer is flushed at the end only
+    struct journal_entry {
+        pak::item const* item = nullptr;
+        size_t files = 0; // queued before the next item
+    };
+    std::deque<journal_entry> pending;
+
+    auto const write_journal = [&](bool all) {
+        if (all && !writer->flush())
+            return false;
+
+        auto const written_files = writer->done_files();
+        if (pending.empty() || (pending.front().files > written_files))
+            return bool(journal);
 
-    scope_data data_compressed(max_data_size);
-    scope_data data_decompressed(max_data_size);
+        while (!pending.empty() && (pending.front().files <= written_files)) {
+            journal << pending.front().item->index << ' ' << pending.front().item->size_compressed << '\n';
+            pending.pop_front();
+        }
+        journal.flush();
+
+        return bool(journal);
+    };
+
+    size_t streamed_files = 0; // large items
+    size_t skipped_files = 0;  // --resume
+
+    // --sync: what downstream tools have to rebuild
+    string_list added;
+    string_list changed;
+    string_list removed;
+
+    auto const note = [&](pak::item const& item, fs::path const& file, file_state state) {
+        if (state == file_state::same)
+            return;
+
+        auto name = item.filename;
+        if (file.extension() == compressed_extension)
+            name += compressed_extension;
+
+        on_log_info(std::format("{} - {} ({})", item.index, name, state == file_state::missing ? "added" : "changed"));
+        (state == file_state::missing ? added : changed).push_back(name);
+    };
+
+    auto const existing_state = [](fs::path const& file) {
+        std::error_code ec;
+        return fs::exists(file, ec) ? file_state::changed : file_state::missing;
+    };
 
     for (auto& item : pak->items) {
         if (!valid_parameter(item))
             continue;
 
-        auto data_size = item.end - item.begin;
+        trace::span span("item", item.filename);
+
+        if ((pending.size() >= journal_batch) && !write_journal(false)) {
+            on_log_error(writer->error.empty() ? std::format("cannot write file: {}", journal_file.string()) : writer->error);
+            return false;
+        }
+
+        bool const decompress = item.compressed && options.decompress;
+
+        auto data_size = item.end - item.begin;
+        if (!item.compressed && (item.size > 0))
+            data_size = std::min(data_size, item.size); // aligned pak
+        else if (item.compressed && !decompress)
+            item.size_compressed = data_size = gzip_size(*pak_data, item.begin, data_size, item.size);
+
+        auto data_file = output_path;
+        data_file += fs::path::preferred_separator;
+        data_file += item.filename;
+
+        auto data_target_file = data_file;
+        if (item.compressed)
+            data_target_file += compressed_extension;
+
+        // outputs of an earlier run that are complete
+        if (auto const it = done.find(item.index); it != done.end()) {
+            std::error_code ec;
+            auto const target_size = decompress ? it->second : data_size;
+
+            if ((fs::file_size(data_target_file, ec) == uintmax_t(target_size))
+                && (!decompress || (fs::file_size(data_file, ec) == uintmax_t(item.size)))) {
+                item.size_compressed = it->second;
+                pending.push_back({&item, writer->queued_files()});
+                ++skipped_files;
+                continue;
+            }
+        }
+
+        if (!options.sync)
+            on_log_info(std::format("{} - {}", item.index, item.filename));
+
+        // sync compares the buffers with one chunk of the existing file
+        bool const fits = options.sync ? (decompress ? buffers->fits({size_t(data_size), size_t(item.size), stream_chunk_size})
+                                                     : buffers->fits({size_t(data_size), stream_chunk_size}))
+                                       : (decompress ? buffers->fits({size_t(data_size), size_t(item.size)})
+                                                     : buffers->fits({size_t(data_size)}));
+        if (!fits) {
+            if (!writer->flush()) { // streaming needs the queued buffers
+                on_log_error(writer->error);
+                return false;
+            }
+
+            // the .comp without padding, inflating tells it as well
+            auto const target_size = decompress ? gzip_size(*pak_data, item.begin, data_size, item.size) : data_size;
+
+            // both files are compared on their own, only what differs is rewritten
+            auto target_state = file_state::changed;
+            auto data_state = decompress ? file_state::changed : file_state::same;
+
+            if (options.sync) {
+                file.seekg(item.begin);
+                target_state = compare_stream(file, target_size, data_target_file, *buffers);
+
+                if (decompress && ((data_state = existing_state(data_file)) == file_state::changed)) {
+                    // inflated against the existing file, no output
+                    std::ifstream existing(data_file, std::ios::binary);
+                    auto chunk = buffers->acquire(stream_chunk_size);
+
+                    auto const sink = [&](char const* data, size_t size) {
+                        if (!existing.read(chunk.data(), size) || (std::memcmp(chunk.data(), data, size) != 0))
+                            return false;
+                        return true;
+                    };
+
+                    int64_t compressed_data_size = 0;
+                    int64_t decompressed_data_size = 0;
+
+                    file.clear();
+                    file.seekg(item.begin);
+                    if (inflate_stream(file, data_size, sink, *buffers, compressed_data_size, decompressed_data_size)
+                        && (existing.peek() == std::char_traits<char>::eof())) {
+                        data_state = file_state::same;
+                        item.size_compressed = compressed_data_size;
+                    }
+                }
+
+                if ((data_state == file_state::same) && (target_state == file_state::same)) {
+                    pending.push_back({&item, writer->queued_files()});
+                    continue;
+                }
+
+                if (decompress)
+                    note(item, data_file, data_state);
+                note(item, data_target_file, target_state);
+            }
+
+            file.clear();
+            file.seekg(item.begin);
+
+            bool const write_target = target_state != file_state::same;
+
+            std::ofstream target_file;
+            if (write_target) {
+                target_file.open(data_target_file, std::ios::binary);
+                if (!target_file) {
+                    on_log_error(std::format("cannot write file: {}", data_target_file.string()));
+                    return false;
+                }
+            }
+
+            if (data_state == file_state::same) { // the .comp only
+                if (!copy_stream(file, target_size, target_file, *buffers)) {
+                    on_log_error(std::format("cannot write file: {}", data_target_file.string()));
+                    return false;
+                }
+
+                if (decompress)
+                    item.size_compressed = target_size;
+
+                pending.push_back({&item, writer->queued_files()});
+                ++streamed_files;
+                continue;
+            }
+
+            std::ofstream decompressed_file(data_file, std::ios::binary);
+            if (!decompressed_file) {
+                on_log_error(std::format("cannot write file: {}", data_file.string()));
+                return false;
+            }
+
+            int64_t compressed_data_size = 0;
+            int64_t decompressed_data_size = 0;
+
+            if (!inflate_stream(file,
+                                data_size,
+                                decompressed_file,
+                                *buffers,
+                                compressed_data_size,
+                                decompressed_data_size,
+                                write_target ? &target_file : nullptr)) {
+                on_log_error(std::format("decompress file: {}", data_file.string()));
+                return false;
+            }
+
+            item.size_compressed = compressed_data_size;
+
+            if (write_target) {
+                target_file.close();
+                if (compressed_data_size < data_size)
+                    fs::resize_file(data_target_file, compressed_data_size);
+            }
+
+            pending.push_back({&item, writer->queued_files()});
+            streamed_files += write_target ? 2 : 1;
+            continue;
+        }
+
+        auto data_compressed = buffers->acquire(data_size, reclaim);
+
+        if (pak->mapping && pak->mapping->contains(item.begin, data_size)) {
+            trace::span span("read");
+            std::memcpy(data_compressed.data(), pak->mapping->data() + item.begin, data_size);
+        } else {
+            file.seekg(item.begin);
+            read_data(file, data_compressed.data(), data_size);
+        }
+
+        if (decompress) {
+            auto data_decompressed = buffers->acquire(item.size, reclaim);
+
+            size_t compressed_data_size = data_size;
+            size_t decompressed_data_size = item.size;
+
+            if (!decompress_data(data_compressed.data(),
+                                 compressed_data_size,
+                                 data_decompressed.data(),
+                                 decompressed_data_size)) {
+                on_log_error(std::format("decompress file: {}", data_file.string()));
+                return false;
+            }
+
+            item.size_compressed = compressed_data_size;
+            data_compressed.resize(compressed_data_size);
+
+            data_decompressed.resize(decompressed_data_size);
+
+            auto const state = options.sync ? compare_data(data_decompressed.data(), decompressed_data_size, data_file, *buffers, reclaim)
+                                            : file_state::changed;
+            if (state != file_state::same) {
+                note(item, data_file, state);
+                writer->write(data_file, std::move(data_decompressed));
+            }
+        }
+
+        auto const state = options.sync ? compare_data(data_compressed.data(), data_compressed.size(), data_target_file, *buffers, reclaim)
+                                        : file_state::changed;
+        if (state != file_state::same) {
+            note(item, data_target_file, state);
+            writer->write(data_target_file, std::move(data_compressed));
+        }
+
+        pending.push_back({&item, writer->queued_files()});
+    }
+
+    file.close();
+
+    if (!write_journal(true)) {
+        on_log_error(writer->error.empty() ? std::format("cannot write file: {}", journal_file.string()) : writer->error);
+        return false;
+    }
+
+    journal.close();
+    fs::remove(journal_file);
+
+    if (skipped_files > 0)
+        on_log_info(std::format("{} items already unpacked", skipped_files));
+
+    if (options.sync && !sync_changes(pak, output_path, added, changed, removed))
+        return false;
+
+    auto const files = writer->files + streamed_files;
+
+    std::chrono::duration<double> const duration = std::chrono::steady_clock::now() - start_time;
+    on_log_info(std::format("{} files in {:.2f}s - {:.0f} files/s ({})",
+                            files,
+                            duration.count(),
+                            files / std::max(duration.count(), 1e-9),
+                            writer->backend()));
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool paker::sync_changes(pak::ptr pak,
+                         fs::path const& output_path,
+                         string_list const& added,
+                         string_list const& changed,
+                         string_list& removed) const {
+    // files the pak still has, in any mode
+    std::set<fs::path> expected = {fs::path(pakinfo_json), fs::path(pakchanges_json), fs::path(unpack_journal)};
+    for (auto const& item : pak->items) {
+        fs::path const file = fs::path(item.filename).lexically_normal();
+        expected.insert(file);
+
+        if (item.compressed)
+            expected.insert(fs::path(item.filename + compressed_extension).lexically_normal());
+    }
+
+    std::vector<fs::path> stale;
+
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(output_path, ec), end; !ec && (it != end); it.increment(ec)) {
+        if (!it->is_regular_file(ec))
+            continue;
+
+        auto const file = it->path().lexically_relative(output_path);
+        if (!expected.contains(file))
+            stale.push_back(it->path());
+    }
+
+    for (auto const& file : stale) {
+        auto const name = file.lexically_relative(output_path).generic_string();
+        if (!fs::remove(file, ec)) {
+            on_log_error(std::format("cannot remove file: {}", file.string()));
+            return false;
+        }
+
+        on_log_info(std::format("{} (removed)", name));
+        removed.push_back(name);
+    }
+
+    json j;
+    j["added"] = added;
+    j["changed"] = changed;
+    j["removed"] = removed;
+
+    auto changes_file = output_path;
+    changes_file += fs::path::preferred_separator;
+    changes_file += pakchanges_json;
+
+    std::ofstream file(changes_file);
+    if (!file) {
+        on_log_error(std::format("cannot write file: {}", changes_file.string()));
+        return false;
+    }
+
+    auto const j_string = j.dump(4);
+    file.write(j_string.data(), j_string.size());
+
+    on_log_info(std::format("synced: {} added, {} changed, {} removed", added.size(), changed.size(), removed.size()));
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+pak_writer::ptr paker::open_pak(fs::path const& output_file,
+                                int64_t expected_size) const {
+    auto writer = pak_writer::open(output_file, expected_size, options.direct);
+    if (!writer) {
+        on_log_error(std::format("cannot write file: {}", output_file.string()));
+        return nullptr;
+    }
+
+    if (options.direct && !writer->direct)
+        on_log_info("no direct io on this file system, writing through the page cache");
+
+    return writer;
+}
+
+//-----------------------------------------------------------------------------
+bool paker::pack(pak::ptr pak,
+                 fs::path const& input_path,
+                 fs::path const& output_file) const {
+    // reserved up front, compressed items by their last size
+    int64_t expected_size = index_header::fixed_size + index_footer::fixed_size;
+    for (auto const& item : pak->items) {
+        expected_size += index_entry::size(item);
+        if (valid_parameter(item))
+            expected_size += ((item.compressed && (item.size_compressed > 0)) ? item.size_compressed : item.size) + parameters.align;
+    }
+
+    auto writer = open_pak(output_file, expected_size);
+    if (!writer)
+        return false;
+
+    std::ostream pak_file(writer.get());
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    int64_t padding = 0;
+    store_report report;
+
+    for (auto& item : pak->items) {
+        if (!valid_parameter(item))
+            continue;
+
+        trace::span span("item", item.filename);
+
+        on_log_info(std::format("{} - {}", item.index, item.filename));
+
+        padding += write_padding(pak_file, parameters.align, crc);
+
+        auto data_file = input_path;
+        data_file += fs::path::preferred_separator;
+        data_file += item.filename;
+
+        if (options.auto_store && options.decompress && item.compressed)
+            auto_store(item, data_file, report);
+
+        auto data_target_file = data_file;
+        if (item.compressed)
+            data_target_file += compressed_extension;
+
+        if (options.decompress && item.compressed) {
+            std::ifstream decompressed_file(data_file, std::ios::binary);
+            if (!decompressed_file) {
+                on_log_error(std::format("cannot read file: {}", data_file.string()));
+                return false;
+            }
+
+            decompressed_file.seekg(0, decompressed_file.end);
+            size_t decompressed_size = decompressed_file.tellg();
+            decompressed_file.seekg(0, decompressed_file.beg);
+
+            if (fs::exists(data_target_file))
+                fs::remove(data_target_file);
+
+            std::ofstream compressed_file(data_target_file, std::ios::binary);
+            if (!compressed_file) {
+                on_log_error(std::format("cannot write file: {}", data_target_file.string()));
+                return false;
+            }
+
+            if (!options.best && parallel_deflate(*workers, decompressed_size)) {
+                int64_t decompressed_data_size = 0;
+                int64_t compressed_data_size = 0;
+
+                // sidecar and pak in one pass
+                auto const sink = [&](char const* data, size_t data_size) {
+                    write_data(compressed_file, data, data_size);
+                    write_data(pak_file, data, data_size);
+                    crc = update_crc(crc, data, data_size);
+                    return compressed_file && pak_file;
+                };
+
+                item.begin = pak_file.tellp();
+
+                if (!deflate_parallel(decompressed_file,
+                                      sink,
+                                      *workers,
+                                      *buffers,
+                                      decompressed_data_size,
+                                      compressed_data_size,
+                                      item_settings(item))) {
+                    on_log_error(std::format("compress file: {}", data_file.string()));
+                    return false;
+                }
+
+                item.size = decompressed_data_size;
+                item.size_compressed = compressed_data_size;
+
+                item.end = pak_file.tellp();
+                continue;
+            }
+
+            if (!buffers->fits({decompressed_size, compress_bound(decompressed_size)})) {
+                int64_t decompressed_data_size = 0;
+                int64_t compressed_data_size = 0;
+
+                if (!deflate_stream(decompressed_file,
+                                    compressed_file,
+                                    *buffers,
+                                    decompressed_data_size,
+                                    compressed_data_size,
+                                    item_settings(item))) {
+                    on_log_error(std::format("compress file: {}", data_file.string()));
+                    return false;
+                }
+
+                item.size = decompressed_data_size;
+                item.size_compressed = compressed_data_size;
+            } else {
+                auto decompressed_data = buffers->acquire(decompressed_size);
+                read_data(decompressed_file, decompressed_data.data(), decompressed_size);
+                decompressed_file.close();
+
+                item.size = decompressed_size;
+
+                buffer_pool::buffer compressed_data;
+                size_t compressed_data_size = 0;
+
+                if (options.best) {
+                    auto settings = item.best.value_or(item_settings(item));
+                    if (!compress_best(decompressed_data.data(),
+                                       decompressed_size,
+                                       compressed_data,
+                                       settings)) {
+                        on_log_error(std::format("compress file: {}", data_file.string()));
+                        return false;
+                    }
+
+                    compressed_data_size = compressed_data.size();
+                    item.best = settings;
+                } else {
+                    compressed_data = buffers->acquire(compress_bound(decompressed_size));
+                    compressed_data_size = compressed_data.size();
+
+                    if (!compress_data(decompressed_data.data(),
+                                       decompressed_size,
+                                       compressed_data.data(),
+                                       compressed_data_size,
+                                       item_settings(item))) {
+                        on_log_error(std::format("compress file: {}", data_file.string()));
+                        return false;
+                    }
+                }
+
+                item.size_compressed = compressed_data_size;
+
+                write_data(compressed_file, compressed_data.data(), compressed_data_size);
+                compressed_file.close();
+
+                // no need to read the sidecar back
+                item.begin = pak_file.tellp();
+
+                write_data(pak_file, compressed_data.data(), compressed_data_size);
+                crc = update_crc(crc, compressed_data.data(), compressed_data_size);
+
+                item.end = pak_file.tellp();
+                continue;
+            }
+        }
+
+        std::ifstream target_file(data_target_file, std::ios::binary);
+        if (!target_file) {
+            on_log_error(std::format("cannot read file: {}", data_target_file.string()));
+            return false;
+        }
+
+        target_file.seekg(0, target_file.end);
+        size_t const target_size = target_file.tellg();
+        target_file.seekg(0, target_file.beg);
+
+        if (!item.compressed)
+            item.size = target_size;
+
+        item.begin = pak_file.tellp();
+
+        if (buffers->fits({target_size})) {
+            auto data = buffers->acquire(target_size);
+            read_data(target_file, data.data(), target_size);
+
+            write_data(pak_file, data.data(), target_size);
+            crc = update_crc(crc, data.data(), target_size);
+        } else if (!copy_stream(target_file, target_size, pak_file, *buffers, &crc)) {
+            on_log_error(std::format("cannot write file: {}", output_file.string()));
+            return false;
+        }
+
+        item.end = pak_file.tellp();
+    };
+
+    write_index(pak, pak_file, crc);
+    log_padding(padding, pak_file.tellp());
+    log_auto_store(report);
+
+    if (!writer->close() || !pak_file) {
+        on_log_error(writer->error.empty() ? std::format("cannot write file: {}", output_file.string()) : writer->error);
+        return false;
+    }
+
+    // winners for later runs
+    if (options.best && !pak->write_info(input_path)) {
+        on_log_error(std::format("cannot write file: {}", pakinfo_json));
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool paker::build(fs::path const& input_path,
+                  fs::path const& output_file) const {
+    build_rules rules;
+    if (!parameters.rules.empty()) {
+        string error;
+        if (!load_rules(parameters.rules, rules, error)) {
+            on_log_error(error);
+            return false;
+        }
+    }
+
+    auto const start_time = clock::now();
+
+    string_list scan_errors;
+    auto const files = scan_tree(input_path, *workers, scan_errors);
+    if (!scan_errors.empty()) {
+        for (auto const& error : scan_errors)
+            on_log_error(error);
+        return false;
+    }
+
+    on_log_info(std::format("{} files found in {:.2f}s", files.size(),
+                            std::chrono::duration<double>(clock::now() - start_time).count()));
+
+    std::ofstream pak_file(output_file, std::ios::binary);
+    if (!pak_file) {
+        on_log_error(std::format("cannot write file: {}", output_file.string()));
+        return false;
+    }
+
+    auto pak = pak::create();
+    pak->version = rules.pak_version;
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    int64_t padding = 0;
+
+    // items read and compressed on the workers, written in order
+    struct job {
+        pak::item item;
+        fs::path file;
+
+        buffer_pool::buffer data;
+        buffer_pool::buffer compressed_data;
+        size_t compressed_size = 0;
+        bool valid = false;
+
+        std::unique_ptr<worker_pool::group> task;
+    };
+    std::deque<job> jobs;
+
+    bool failed = false;
+
+    // oldest job into the pak, false if none in flight
+    auto const write_job = [&]() {
+        if (jobs.empty())
+            return false;
+
+        auto& j = jobs.front();
+        j.task->wait();
+
+        if (!j.valid) {
+            on_log_error(std::format("{} file: {}", j.item.compressed ? "compress" : "cannot read", j.file.string()));
+            failed = true;
+
+            jobs.pop_front();
+            return true;
+        }
+
+        auto& item = j.item;
+        auto const& data = item.compressed ? j.compressed_data : j.data;
+        auto const data_size = item.compressed ? j.compressed_size : size_t(item.size);
+
+        padding += write_padding(pak_file, parameters.align, crc);
+        item.begin = pak_file.tellp();
+
+        pak_file.write(data.data(), data_size);
+        crc = update_crc(crc, data.data(), data_size);
+
+        item.end = pak_file.tellp();
+        pak->items.push_back(std::move(item));
+
+        jobs.pop_front();
+        return true;
+    };
+
+    auto const max_jobs = 2 * workers->size();
+
+    for (auto const& scanned : files) {
+        if (failed)
+            break;
+
+        auto const rule = rules.find(scanned.name);
+        if (rule && rule->exclude)
+            continue;
+
+        job j;
+        j.file = input_path / fs::path(scanned.name);
+
+        auto& item = j.item;
+        item.filename = scanned.name;
+        item.compressed = !rule || rule->compress;
+        item.size = scanned.size;
+
+        item.index = pak->items.size() + jobs.size();
+
+        auto const settings = parameters.compression.value_or(rule && rule->settings ? *rule->settings : compression_settings());
+
+        on_log_info(std::format("{} - {}", item.index, item.filename));
+
+        auto const size = size_t(scanned.size);
+        bool const stream = item.compressed ? (parallel_deflate(*workers, size) || !buffers->fits({size, compress_bound(size)}))
+                                            : !buffers->fits({size});
+        if (stream) {
+            while (write_job())
+                ;
+
+            std::ifstream input(j.file, std::ios::binary);
+            if (!input) {
+                on_log_error(std::format("cannot read file: {}", j.file.string()));
+                return false;
+            }
+
+            padding += write_padding(pak_file, parameters.align, crc);
+            item.begin = pak_file.tellp();
+
+            bool streamed = true;
+            if (!item.compressed) {
+                streamed = copy_stream(input, item.size, pak_file, *buffers, &crc);
+            } else {
+                int64_t decompressed_data_size = 0;
+                int64_t compressed_data_size = 0;
+
+                if (parallel_deflate(*workers, size)) {
+                    auto const sink = [&](char const* data, size_t data_size) {
+                        pak_file.write(data, data_size);
+                        crc = update_crc(crc, data, data_size);
+                        return bool(pak_file);
+                    };
+
+                    streamed = deflate_parallel(input, sink, *workers, *buffers,
+                                                decompressed_data_size, compressed_data_size, settings);
+                } else {
+                    streamed = deflate_stream(input, pak_file, *buffers,
+                                              decompressed_data_size, compressed_data_size, settings, &crc);
+                }
+
+                item.size = decompressed_data_size;
+                item.size_compressed = compressed_data_size;
+            }
+
+            if (!streamed) {
+                on_log_error(std::format("compress file: {}", j.file.string()));
+                return false;
+            }
+
+            item.end = pak_file.tellp();
+            pak->items.push_back(std::move(item));
+            continue;
+        }
+
+        while (jobs.size() >= max_jobs)
+            write_job();
+
+        j.data = buffers->acquire(size, write_job);
+        if (item.compressed)
+            j.compressed_data = buffers->acquire(compress_bound(size), write_job);
+
+        jobs.push_back(std::move(j));
+
+        auto& queued = jobs.back();
+        queued.task = std::make_unique<worker_pool::group>(*workers);
+        queued.task->run([&j = queued, settings]() {
+            std::ifstream input(j.file, std::ios::binary);
+            if (!input.read(j.data.data(), j.item.size))
+                return;
+
+            if (!j.item.compressed) {
+                j.valid = true;
+                return;
+            }
+
+            size_t decompressed_data_size = j.item.size;
+            j.compressed_size = j.compressed_data.size();
+
+            j.valid = compress_data(j.data.data(),
+                                    decompressed_data_size,
+                                    j.compressed_data.data(),
+                                    j.compressed_size,
+                                    settings);
+            j.item.size_compressed = j.compressed_size;
+        });
+    }
+
+    while (write_job())
+        ;
+
+    if (failed)
+        return false;
+
+    for (auto const& item : pak->items)
+        pak->max_size = std::max(pak->max_size, item.size);
+    pak->count = pak->items.size();
+
+    write_index(pak, pak_file, crc);
+    log_padding(padding, pak_file.tellp());
+
+    pak_file.close();
+
+    std::chrono::duration<double> const duration = clock::now() - start_time;
+    on_log_info(std::format("{} items in {:.2f}s", pak->count, duration.count()));
+    return bool(pak_file);
+}
+
+//-----------------------------------------------------------------------------
+bool paker::patch_files(fs::path const& pak_file,
+                        fs::path const& output_file,
+                        string_list const& files) const {
+    auto pak = pak::create();
+    if (!pak->parse(pak_file)) {
+        on_log_error(std::format("cannot parse file: {}", pak_file.string()));
+        return false;
+    }
+
+    return patch_files(pak, pak_file, output_file, files);
+}
+
+//-----------------------------------------------------------------------------
+bool paker::patch_files(pak::ptr pak,
+                        fs::path const& pak_file,
+                        fs::path const& output_file,
+                        string_list const& files) const {
+    std::ifstream input(pak_file, std::ios::binary);
+    if (!input) {
+        on_log_error(std::format("cannot read file: {}", pak_file.string()));
+        return false;
+    }
+
+    // old pak plus all replacements at most
+    std::error_code ec;
+    int64_t expected_size = fs::file_size(pak_file, ec) + int64_t(pak->items.size()) * parameters.align;
+    for (auto const& file : files)
+        expected_size += fs::file_size(file, ec);
+
+    auto writer = open_pak(output_file, expected_size);
+    if (!writer)
+        return false;
+
+    std::ostream output(writer.get());
+
+    auto const pak_data = open_data(*pak, pak_file); // item ends
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    int64_t padding = 0;
+    store_report report;
+
+    for (auto& item : pak->items) {
+        trace::span span("item", item.filename);
+
+        auto const item_begin = item.begin;
+        auto item_size = item.end - item.begin;
+
+        padding += write_padding(output, parameters.align, crc);
+
+        item.begin = output.tellp();
+
+        bool patch = false;
+
+        for (auto const& file : files) {
+            if (item.filename.contains(fs::path(file).filename().string())) {
+                on_log_info(std::format("{} - {}", item.index, item.filename));
+
+                std::ifstream patch_file(file, std::ios::binary);
+                if (!patch_file) {
+                    on_log_error(std::format("cannot read file: {}", file));
+                    return false;
+                }
+
+                patch_file.seekg(0, patch_file.end);
+                size_t patch_size = patch_file.tellg();
+                patch_file.seekg(0, patch_file.beg);
+
+                if (options.auto_store && item.compressed)
+                    auto_store(item, file, report);
+
+                if (item.compressed) {
+                    if (!options.best && parallel_deflate(*workers, patch_size)) {
+                        int64_t decompressed_data_size = 0;
+                        int64_t compressed_data_size = 0;
+
+                        auto const sink = [&](char const* data, size_t data_size) {
+                            write_data(output, data, data_size);
+                            crc = update_crc(crc, data, data_size);
+                            return bool(output);
+                        };
+
+                        if (!deflate_parallel(patch_file,
+                                              sink,
+                                              *workers,
+                                              *buffers,
+                                              decompressed_data_size,
+                                              compressed_data_size,
+                                              item_settings(item))) {
+                            on_log_error(std::format("compress file: {}", file));
+                            return false;
+                        }
+
+                        item.size_compressed = compressed_data_size;
+                        item.size = decompressed_data_size;
+                    } else if (!buffers->fits({patch_size, compress_bound(patch_size)})) {
+                        int64_t decompressed_data_size = 0;
+                        int64_t compressed_data_size = 0;
+
+                        if (!deflate_stream(patch_file,
+                                            output,
+                                            *buffers,
+                                            decompressed_data_size,
+                                            compressed_data_size,
+                                            item_settings(item),
+                                            &crc)) {
+                            on_log_error(std::format("compress file: {}", file));
+                            return false;
+                        }
+
+                        item.size_compressed = compressed_data_size;
+                        item.size = decompressed_data_size;
+                    } else {
+                        auto decompressed_data = buffers->acquire(patch_size);
+                        read_data(patch_file, decompressed_data.data(), patch_size);
+
+                        buffer_pool::buffer compressed_data;
+                        size_t compressed_data_size = 0;
+
+                        if (options.best) {
+                            auto settings = item_settings(item);
+                            if (!compress_best(decompressed_data.data(),
+                                               patch_size,
+                                               compressed_data,
+                                               settings)) {
+                                on_log_error(std::format("compress file: {}", file));
+                                return false;
+                            }
+
+                            compressed_data_size = compressed_data.size();
+                        } else {
+                            compressed_data = buffers->acquire(compress_bound(patch_size));
+                            compressed_data_size = compressed_data.size();
+
+                            if (!compress_data(decompressed_data.data(),
+                                               patch_size,
+                                               compressed_data.data(),
+                                               compressed_data_size,
+                                               item_settings(item))) {
+                                on_log_error(std::format("compress file: {}", file));
+                                return false;
+                            }
+                        }
+
+                        write_data(output, compressed_data.data(), compressed_data_size);
+                        crc = update_crc(crc, compressed_data.data(), compressed_data_size);
+
+                        item.size_compressed = compressed_data_size;
+                        item.size = patch_size;
+                    }
+                } else {
+                    if (!buffers->fits({patch_size})) {
+                        if (!copy_stream(patch_file, patch_size, output, *buffers, &crc)) {
+                            on_log_error(std::format("cannot write file: {}", output_file.string()));
+                            return false;
+                        }
+                    } else {
+                        auto data = buffers->acquire(patch_size);
+                        read_data(patch_file, data.data(), patch_size);
+
+                        write_data(output, data.data(), patch_size);
+                        crc = update_crc(crc, data.data(), patch_size);
+                    }
+
+                    item.size_compressed = patch_size;
+                    item.size = patch_size;
+                }
+
+                patch = true;
+                break;
+            }
+        }
+
+        if (!patch) {
+            // without the padding and the free slots of a watch
+            if (!item.compressed && (item.size > 0))
+                item_size = std::min(item_size, item.size);
+            else if (item.compressed)
+                item_size = gzip_size(*pak_data, item_begin, item_size, item.size);
+
+            input.clear();
+            input.seekg(item_begin);
+
+            if (pak->mapping && pak->mapping->contains(item_begin, item_size)) {
+                auto const data = pak->mapping->data() + item_begin;
+
+                write_data(output, data, item_size);
+                crc = update_crc(crc, data, item_size);
+            } else if (!buffers->fits({size_t(item_size)})) {
+                if (!copy_stream(input, item_size, output, *buffers, &crc)) {
+                    on_log_error(std::format("cannot write file: {}", output_file.string()));
+                    return false;
+                }
+            } else {
+                auto data = buffers->acquire(item_size);
+                read_data(input, data.data(), item_size);
+
+                write_data(output, data.data(), item_size);
+                crc = update_crc(crc, data.data(), item_size);
+            }
+        }
+
+        item.end = output.tellp();
+    };
+
+    write_index(pak, output, crc);
+    log_padding(padding, output.tellp());
+    log_auto_store(report);
+
+    input.close();
+
+    if (!writer->close() || !output) {
+        on_log_error(writer->error.empty() ? std::format("cannot write file: {}", output_file.string()) : writer->error);
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+struct item_reader::state {
+    explicit state(buffer_pool& buffers)
+    : buffers(buffers) {
+    }
+
+    ~state() {
+        if (inflating)
+            inflateEnd(&stream);
+    }
+
+    bool start(pak::item const* next, string& error) {
+        item = next;
+        pos = item->begin;
+        remaining = item->end - item->begin;
+        if (!item->compressed && (item->size > 0))
+            remaining = std::min(remaining, item->size); // aligned pak
+
+        offset = 0;
+        done = false;
+
+        if (archive->mapping ? !archive->mapping->contains(pos, remaining) : !file.seekg(pos)) {
+            error = std::format("cannot read item: {}", item->filename);
+            return false;
+        }
+
+        if (!item->compressed || !decompress)
+            return true;
+
+        if (inflating)
+            inflateEnd(&stream);
+
+        stream = {};
+        inflating = inflateInit2(&stream, 31) == Z_OK;
+        if (!inflating) {
+            error = std::format("decompress item: {}", item->filename);
+            return false;
+        }
+
+        return true;
+    }
+
+    // mapped items in one piece
+    bool input(std::span<char const>& data, string& error) {
+        if (archive->mapping) {
+            data = {archive->mapping->data() + pos, size_t(remaining)};
+        } else {
+            if (!in.data())
+                in = buffers.acquire(chunk_size);
+
+            auto const size = std::min<int64_t>(remaining, in.size());
+            if (!file.read(in.data(), size)) {
+                error = std::format("cannot read item: {}", item->filename);
+                return false;
+            }
+            data = {in.data(), size_t(size)};
+        }
+
+        pos += data.size();
+        remaining -= data.size();
+        return true;
+    }
+
+    bool inflate_output(std::span<char const>& data, string& error) {
+        if (!out.data())
+            out = buffers.acquire(chunk_size);
+
+        stream.avail_out = out.size();
+        stream.next_out = reinterpret_cast<unsigned char*>(out.data());
+
+        while (stream.avail_out == out.size()) { // until something is produced
+            if (stream.avail_in == 0) {
+                std::span<char const> compressed;
+                if ((remaining == 0) || !input(compressed, error)) {
+                    if (error.empty())
+                        error = std::format("decompress item: {}", item->filename); // truncated
+                    return false;
+                }
+
+                stream.avail_in = compressed.size();
+                stream.next_in = reinterpret_cast<unsigned char*>(const_cast<char*>(compressed.data())); // zlib without ZLIB_CONST
+            }
+
+            auto const res = inflate(&stream, Z_NO_FLUSH);
+            if (res == Z_STREAM_END) {
+                inflateEnd(&stream);
+                inflating = false;
+                done = true;
+                break;
+            }
+
+            if ((res != Z_OK) && (res != Z_BUF_ERROR)) {
+                error = std::format("decompress item: {}", item->filename);
+                return false;
+            }
+        }
+
+        data = {out.data(), out.size() - stream.avail_out};
+        return true;
+    }
+
+    pak::ptr archive;
+    std::vector<pak::item const*> items;
+    bool decompress = true;
+    size_t chunk_size = 0;
+
+    buffer_pool& buffers;
+    buffer_pool::buffer in;  // read, unless mapped
+    buffer_pool::buffer out; // inflated
+    std::ifstream file;      // unless mapped
+
+    size_t next_item = 0;
+    pak::item const* item = nullptr;
+    int64_t pos = 0;       // pak address of the unread data
+    int64_t remaining = 0; // unread item data
+    int64_t offset = 0;    // item data handed out
+    bool done = true;      // item complete
+
+    z_stream stream = {};
+    bool inflating = false;
+};
+
+//-----------------------------------------------------------------------------
+item_reader::item_reader(pak::ptr pak,
+                         fs::path const& pak_file,
+                         std::vector<pak::item const*> items,
+                         bool decompress,
+                         buffer_pool& buffers,
+                         size_t chunk_size)
+: s(std::make_unique<state>(buffers)) {
+    s->archive = pak;
+    s->items = std::move(items);
+    s->decompress = decompress;
+    s->chunk_size = chunk_size;
+
+    if (!pak->mapping) {
+        s->file.open(pak_file, std::ios::binary);
+        if (!s->file)
+            error = std::format("cannot read file: {}", pak_file.string());
+    }
+}
+
+//-----------------------------------------------------------------------------
+item_reader::~item_reader() = default;
+item_reader::item_reader(item_reader&&) noexcept = default;
+item_reader& item_reader::operator=(item_reader&&) noexcept = default;
+
+//-----------------------------------------------------------------------------
+bool item_reader::next(item_chunk& chunk) {
+    if (!error.empty())
+        return false;
+
+    if (s->done) {
+        if (s->next_item == s->items.size())
+            return false;
+
+        if (!s->start(s->items[s->next_item++], error))
+            return false;
+    }
+
+    std::span<char const> data;
+    if (s->inflating) {
+        if (!s->inflate_output(data, error))
+            return false;
+    } else {
+        if (!s->input(data, error))
+            return false;
+        s->done = (s->remaining == 0);
+    }
+
+    chunk.item = s->item;
+    chunk.data = data;
+    chunk.offset = s->offset;
+    chunk.last = s->done;
+
+    s->offset += data.size();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool paker::cat(pak::ptr pak,
+                fs::path const& pak_file,
+                string const& filename,
+                std::FILE* output) const {
+    auto const item = find_item(pak, filename);
+    if (!item)
+        return false;
+
+    std::ifstream file(pak_file, std::ios::binary);
+    if (!file) {
+        on_log_error(std::format("cannot read file: {}", pak_file.string()));
+        return false;
+    }
+
+    auto data_size = item->end - item->begin;
+    if (!item->compressed && (item->size > 0))
+        data_size = std::min(data_size, item->size);
+
+    if (!item->compressed) {
+        file.close();
+
+        if (!send_range(output, pak_file, item->begin, data_size, *buffers)) {
+            on_log_error(std::format("cannot write item: {}", item->filename));
+            return false;
+        }
+
+        return std::fflush(output) == 0;
+    }
+
+    file.seekg(item->begin);
+
+    auto const sink = [&](char const* data, size_t size) {
+        return write_file(output, data, size);
+    };
+
+    int64_t compressed_data_size = 0;
+    int64_t decompressed_data_size = 0;
+
+    if (!inflate_stream(file, data_size, sink, *buffers, compressed_data_size, decompressed_data_size)) {
+        on_log_error(std::format("decompress item: {}", item->filename));
+        return false;
+    }
+
+    return std::fflush(output) == 0;
+}
+
+//-----------------------------------------------------------------------------
+bool paker::index(pak::ptr pak,
+                  fs::path const& pak_file) const {
+    // smaller items inflate faster than a checkpoint is found
+    std::vector<pak::item const*> items;
+    for (auto const& item : pak->items) {
+        if (valid_parameter(item) && item.compressed && (item.size >= 2 * int64_t(parameters.checkpoint_span)))
+            items.push_back(&item);
+    }
+
+    std::vector<checkpoint::list> points(items.size());
+    std::vector<char> built(items.size(), false);
+
+    worker_pool::group tasks(*workers);
+    for (auto i = 0u; i < items.size(); ++i) {
+        tasks.run([&, i]() {
+            auto const item = items[i];
+
+            auto input = open_data(*pak, pak_file);
+            input->seekg(item->begin);
+
+            built[i] = checkpoint_index::build(*input, item->end - item->begin, parameters.checkpoint_span, points[i]);
+        });
+    }
+    tasks.wait();
+
+    auto index = checkpoint_index::create();
+    size_t count = 0;
+
+    for (auto i = 0u; i < items.size(); ++i) {
+        if (!built[i]) {
+            on_log_error(std::format("decompress item: {}", items[i]->filename));
+            return false;
+        }
+
+        on_log_info(std::format("{} - {} ({} checkpoints)", items[i]->index, items[i]->filename, points[i].size()));
+
+        count += points[i].size();
+        index->items[items[i]->index] = std::move(points[i]);
+    }
+
+    auto index_file = pak_file;
+    index_file += checkpoint_extension;
+
+    if (!index->save(index_file, pak->crc_value)) {
+        on_log_error(std::format("cannot write file: {}", index_file.string()));
+        return false;
+    }
+
+    std::error_code ec;
+    on_log_info(std::format("{} items, {} checkpoints, {} KB", items.size(), count, fs::file_size(index_file, ec) >> 10));
+
+    pak->checkpoints = index;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool paker::read(pak::ptr pak,
+                 fs::path const& pak_file,
+                 string const& filename,
+                 int64_t offset,
+                 int64_t length,
+                 buffer_pool::buffer& data) const {
+    auto const item = find_item(pak, filename);
+    if (!item)
+        return false;
+
+    if ((offset < 0) || (offset > item->size)) {
+        on_log_error(std::format("invalid offset: {} ({} bytes)", offset, item->size));
+        return false;
+    }
+
+    length = std::min(length < 0 ? item->size : length, item->size - offset);
+    data = buffers->acquire(length);
+
+    auto input = open_data(*pak, pak_file);
+    if (!*input) {
+        on_log_error(std::format("cannot read file: {}", pak_file.string()));
+        return false;
+    }
+
+    if (!item->compressed) {
+        input->seekg(item->begin + offset);
+        if (!input->read(data.data(), length)) {
+            on_log_error(std::format("cannot read item: {}", item->filename));
+            return false;
+        }
+
+        return true;
+    }
+
+    if (!pak->checkpoints) {
+        auto index_file = pak_file;
+        index_file += checkpoint_extension;
+
+        // stale or missing, inflated from the start
+        pak->checkpoints = checkpoint_index::load(index_file, pak->crc_value);
+        if (!pak->checkpoints)
+            pak->checkpoints = checkpoint_index::create();
+    }
+
+    checkpoint::list const none;
+    auto const it = pak->checkpoints->items.find(item->index);
+    auto const& points = (it != pak->checkpoints->items.end()) ? it->second : none;
+
+    size_t size = length;
+    if (!checkpoint_index::read(*input, item->begin, item->end - item->begin, points, offset, data.data(), size)) {
+        on_log_error(std::format("decompress item: {}", item->filename));
+        return false;
+    }
+
+    data.resize(size);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+item_reader paker::read_items(pak::ptr pak,
+                              fs::path const& pak_file) const {
+    std::vector<pak::item const*> items;
+    for (auto const& item : pak->items) {
+        if (valid_parameter(item))
+            items.push_back(&item);
+    }
+
+    return item_reader(pak, pak_file, std::move(items), options.decompress, *buffers);
+}
+
+#ifdef __cpp_lib_generator
+//-----------------------------------------------------------------------------
+std::generator<item_chunk const&> paker::items(pak::ptr pak,
+                                               fs::path pak_file,
+                                               string& error) const {
+    error.clear();
+    auto reader = read_items(pak, pak_file);
+
+    item_chunk chunk;
+    while (reader.next(chunk))
+        co_yield chunk;
+
+    error = reader.error;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+bool paker::export_tar(pak::ptr pak,
+                       fs::path const& pak_file,
+                       std::FILE* output) const {
+    std::ifstream file(pak_file, std::ios::binary);
+    if (!file) {
+        on_log_error(std::format("cannot read file: {}", pak_file.string()));
+        return false;
+    }
+
+    // entries dated like the pak, same pak same archive
+    std::error_code ec;
+    auto const pak_time = std::chrono::file_clock::to_sys(fs::last_write_time(pak_file, ec));
+    auto const mtime = std::chrono::duration_cast<std::chrono::seconds>(pak_time.time_since_epoch()).count();
+
+    static char const zeros[tar::block_size] = {};
+
+    auto const write_header = [&](string const& name, uint64_t size) {
+        auto const header = tar::header(name, size, mtime);
+        return write_file(output, header.data(), header.size());
+    };
+
+    auto const write_padding = [&](uint64_t size) {
+        return write_file(output, zeros, tar::padding(size));
+    };
+
+    // first, import takes the item modes from it
+    auto const info = pak->info();
+    if (!write_header(pakinfo_json, info.size()) || !write_file(output, info.data(), info.size()) || !write_padding(info.size())) {
+        on_log_error("cannot write archive");
+        return false;
+    }
+
+    size_t files = 0;
+
+    for (auto const& item : pak->items) {
+        if (!valid_parameter(item))
+            continue;
+
+        on_log_info(std::format("{} - {}", item.index, item.filename));
+
+        auto data_size = item.end - item.begin;
+        if (!item.compressed && (item.size > 0))
+            data_size = std::min(data_size, item.size); // aligned pak
+        else if (item.compressed && !options.decompress)
+            data_size = gzip_size(file, item.begin, data_size, item.size);
+
+        if (item.compressed && options.decompress) {
+            if (!write_header(item.filename, item.size)) {
+                on_log_error("cannot write archive");
+                return false;
+            }
+
+            auto const sink = [&](char const* data, size_t size) {
+                return write_file(output, data, size);
+            };
+
+            int64_t compressed_data_size = 0;
+            int64_t decompressed_data_size = 0;
+
+            // the header promised item.size bytes
+            file.seekg(item.begin);
+            if (!inflate_stream(file, data_size, sink, *buffers, compressed_data_size, decompressed_data_size)
+                || (decompressed_data_size != item.size)) {
+                on_log_error(std::format("decompress item: {}", item.filename));
+                return false;
+            }
+        } else {
+            auto const name = item.compressed ? item.filename + compressed_extension : item.filename;
+            if (!write_header(name, data_size) || !send_range(output, pak_file, item.begin, data_size, *buffers)) {
+                on_log_error(std::format("cannot write item: {}", item.filename));
+                return false;
+            }
+        }
+
+        auto const entry_size = (item.compressed && options.decompress) ? item.size : data_size;
+        if (!write_padding(entry_size)) {
+            on_log_error("cannot write archive");
+            return false;
+        }
+
+        ++files;
+    }
+
+    auto const end = tar::end();
+    if (!write_file(output, end.data(), end.size()) || (std::fflush(output) != 0)) {
+        on_log_error("cannot write archive");
+        return false;
+    }
+
+    on_log_info(std::format("{} files exported", files));
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool paker::import_tar(std::istream& input,
+                       fs::path const& output_file) const {
+    std::ofstream pak_file(output_file, std::ios::binary);
+    if (!pak_file) {
+        on_log_error(std::format("cannot write file: {}", output_file.string()));
+        return false;
+    }
+
+    auto pak = pak::create();
+
+    // pakinfo.json of an export: modes and sizes by name
+    std::map<string, pak::item> known;
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    int64_t padding = 0;
+
+    tar::reader reader(input);
+    tar::entry entry;
+
+    while (reader.next(entry)) {
+        if (!entry.regular())
+            continue;
+
+        auto name = entry.name;
+        if (name.starts_with("./"))
+            name.erase(0, 2);
+
+        if (name == pakinfo_json) {
+            string data(entry.size, '\0');
+            input.read(data.data(), entry.size);
+            reader.consume(entry.size);
+
+            if (!json::accept(data)) {
+                on_log_error(std::format("invalid {} in archive", pakinfo_json));
+                return false;
+            }
+
+            // missing keys take the defaults, wrong types are errors
+            auto const typed = [](json const& j_object, char const* key, bool (json::*is_type)() const noexcept) {
+                return !j_object.contains(key) || (j_object[key].*is_type)();
+            };
+
+            auto const j = json::parse(data);
+            if (!j.is_object() || !typed(j, "version", &json::is_number_integer) || !typed(j, "files", &json::is_array)) {
+                on_log_error(std::format("invalid {} in archive", pakinfo_json));
+                return false;
+            }
+
+            pak->version = j.value("version", pak->version);
+
+            for (auto const& j_item : j.value("files", json::array())) {
+                if (!j_item.is_object()
+                    || !j_item.contains("filename") || !j_item["filename"].is_string()
+                    || !typed(j_item, "compressed", &json::is_boolean)
+                    || !typed(j_item, "size", &json::is_number_integer)
+                    || !typed(j_item, "best", &json::is_object)) {
+                    on_log_error(std::format("invalid {} entry in archive: {}", pakinfo_json, j_item.dump()));
+                    return false;
+                }
+
+                pak::item item;
+                item.filename = j_item.value("filename", "");
+                item.compressed = j_item.value("compressed", false);
+                item.size = j_item.value("size", int64_t(0));
+
+                if (j_item.contains("best")) {
+                    auto const& j_best = j_item["best"];
+                    if (!typed(j_best, "level", &json::is_number_integer)
+                        || !typed(j_best, "strategy", &json::is_number_integer)
+                        || !typed(j_best, "mem_level", &json::is_number_integer)) {
+                        on_log_error(std::format("invalid {} entry in archive: {}", pakinfo_json, j_item.dump()));
+                        return false;
+                    }
+
+                    compression_settings best;
+                    best.level = j_best.value("level", best.level);
+                    best.strategy = j_best.value("strategy", best.strategy);
+                    best.mem_level = j_best.value("mem_level", best.mem_level);
+                    item.best = best;
+                }
+
+                known[item.filename] = item;
+            }
+            continue;
+        }
+
+        pak::item item;
+        item.index = pak->items.size();
+
+        // compressed data as exported with -c
+        bool const raw = name.ends_with(compressed_extension);
+        item.filename = raw ? name.substr(0, name.size() - std::strlen(compressed_extension)) : name;
+
+        auto const it = known.find(item.filename);
+        if (it != known.end()) {
+            item.compressed = it->second.compressed;
+            item.best = it->second.best;
+        }
+
+        if (raw)
+            item.compressed = true;
+
+        if (!valid_parameter(item))
+            continue;
+
+        on_log_info(std::format("{} - {}", item.index, item.filename));
+
+        padding += write_padding(pak_file, parameters.align, crc);
+        item.begin = pak_file.tellp();
+
+        if (raw) {
+            auto chunk = buffers->acquire(stream_chunk_size);
+            uint32_t gzip_size = 0; // trailer, modulo 4 GB
+
+            // without a pakinfo.json entry the trailer is ambiguous once the
+            // stream could inflate past 4 GB, the size is counted on the way
+            bool const count_size = (it == known.end()) && (int64_t(entry.size) > int64_t(UINT32_MAX) / deflate_max_ratio);
+
+            z_stream stream = {0};
+            buffer_pool::buffer discard;
+            if (count_size) {
+                if (inflateInit2(&stream, 31) != Z_OK) {
+                    on_log_error(std::format("decompress entry: {}", name));
+                    return false;
+                }
+                discard = buffers->acquire(stream_chunk_size);
+            }
+
+            auto res = Z_OK;
+            int64_t inflated_size = 0; // total_out is 32 bits on Windows
+            for (auto size = int64_t(entry.size); size > 0;) {
+                auto const chunk_size = std::min<int64_t>(size, chunk.size());
+                if (!input.read(chunk.data(), chunk_size)) {
+                    on_log_error(std::format("truncated entry: {}", name));
+                    if (count_size)
+                        inflateEnd(&stream);
+                    return false;
+                }
+
+                pak_file.write(chunk.data(), chunk_size);
+                crc = update_crc(crc, chunk.data(), chunk_size);
+
+                for (auto i = std::max<int64_t>(0, chunk_size - 4); i < chunk_size; ++i)
+                    gzip_size = (gzip_size >> 8) | (uint32_t(static_cast<unsigned char>(chunk.data()[i])) << 24);
+
+                stream.avail_in = count_size ? chunk_size : 0;
+                stream.next_in = reinterpret_cast<unsigned char*>(chunk.data());
+                while ((stream.avail_in > 0) && (res == Z_OK)) {
+                    stream.avail_out = discard.size();
+                    stream.next_out = reinterpret_cast<unsigned char*>(discard.data());
+                    res = inflate(&stream, Z_NO_FLUSH);
+                    inflated_size += discard.size() - stream.avail_out;
+                }
+
+                size -= chunk_size;
+            }
+
+            item.size = (it != known.end()) ? it->second.size : gzip_size;
+            item.size_compressed = entry.size;
+
+            if (count_size) {
+                item.size = inflated_size;
+                inflateEnd(&stream);
+
+                if (res != Z_STREAM_END) {
+                    on_log_error(std::format("decompress entry: {}", name));
+                    return false;
+                }
+            }
+        } else if (!item.compressed) {
+            if (!copy_stream(input, entry.size, pak_file, *buffers, &crc)) {
+                on_log_error(std::format("truncated entry: {}", name));
+                return false;
+            }
+
+            item.size = entry.size;
+        } else if (!buffers->fits({size_t(entry.size), compress_bound(entry.size)})) {
+            int64_t decompressed_data_size = 0;
+            int64_t compressed_data_size = 0;
+
+            if (!deflate_stream(input,
+                                pak_file,
+                                *buffers,
+                                decompressed_data_size,
+                                compressed_data_size,
+                                item_settings(item),
+                                &crc,
+                                entry.size)
+                || (decompressed_data_size != int64_t(entry.size))) {
+                on_log_error(std::format("compress entry: {}", name));
+                return false;
+            }
+
+            item.size = decompressed_data_size;
+            item.size_compressed = compressed_data_size;
+        } else {
+            auto decompressed_data = buffers->acquire(entry.size);
+            if (!input.read(decompressed_data.data(), entry.size)) {
+                on_log_error(std::format("truncated entry: {}", name));
+                return false;
+            }
+
+            auto compressed_data = buffers->acquire(compress_bound(entry.size));
+
+            size_t decompressed_data_size = entry.size;
+            size_t compressed_data_size = compressed_data.size();
+
+            if (!compress_data(decompressed_data.data(),
+                               decompressed_data_size,
+                               compressed_data.data(),
+                               compressed_data_size,
+                               item_settings(item))) {
+                on_log_error(std::format("compress entry: {}", name));
+                return false;
+            }
+
+            pak_file.write(compressed_data.data(), compressed_data_size);
+            crc = update_crc(crc, compressed_data.data(), compressed_data_size);
+
+            item.size = entry.size;
+            item.size_compressed = compressed_data_size;
+        }
+
+        reader.consume(entry.size);
+
+        item.end = pak_file.tellp();
+        pak->max_size = std::max(pak->max_size, item.size);
+        pak->items.push_back(std::move(item));
+    }
+
+    if (!reader.error.empty()) {
+        on_log_error(std::format("cannot read archive: {}", reader.error));
+        return false;
+    }
+
+    pak->count = pak->items.size();
+
+    write_index(pak, pak_file, crc);
+    log_padding(padding, pak_file.tellp());
+
+    pak_file.close();
+    return bool(pak_file);
+}
+
+//-----------------------------------------------------------------------------
+pak::item const* paker::find_item(pak::ptr pak, string const& filename) const {
+    auto normalize = [](string name) {
+        std::replace(name.begin(), name.end(), '\\', '/');
+        return name;
+    };
+    auto const name = normalize(filename);
+
+    for (auto const& item : pak->items) {
+        if (normalize(item.filename) == name)
+            return &item;
+    }
+
+    // unique part of a name, like patch
+    pak::item const* found = nullptr;
+    for (auto const& item : pak->items) {
+        if (!normalize(item.filename).contains(name))
+            continue;
+
+        if (found) {
+            on_log_error(std::format("ambiguous name: {} ({}, {}, ...)", filename, found->filename, item.filename));
+            return nullptr;
+        }
+        found = &item;
+    }
+
+    if (!found)
+        on_log_error(std::format("no such item: {}", filename));
+
+    return found;
+}
+
+//-----------------------------------------------------------------------------
+bool paker::analyze(pak::ptr pak,
+                    fs::path const& pak_file,
+                    fs::path const& output_file) const {
+    std::ifstream file(pak_file, std::ios::binary);
+    if (!file) {
+        on_log_error(std::format("cannot read file: {}", pak_file.string()));
+        return false;
+    }
+
+    if (!pak->mapping)
+        pak->map(pak_file);
+
+    struct result {
+        pak::item const* item = nullptr;
+        int64_t stored = 0; // gzip stream, without alignment
+        int64_t decode_ns = 0;
+        bool valid = true;
+    };
+    std::vector<result> results;
+
+    for (auto const& item : pak->items) {
+        if (valid_parameter(item))
+            results.push_back({&item, item.size});
+    }
+
+    auto const start_time = clock::now();
+    {
+        // oldest first, the reads stay a few items ahead of the workers
+        std::deque<std::unique_ptr<worker_pool::group>> tasks;
+        auto const max_tasks = 2 * workers->size();
+
+        for (auto& r : results) {
+            auto const& item = *r.item;
+            if (!item.compressed)
+                continue;
+
+            auto const data_size = item.end - item.begin;
+
+            while (tasks.size() >= max_tasks)
+                tasks.pop_front();
+
+            // without a mapping the items are read here, one by one; buffers are
+            // taken before queuing, tasks only release, so the limit waits on them
+            buffer_pool::buffer data_compressed;
+            char const* data = nullptr;
+
+            bool const mapped = pak->mapping && pak->mapping->contains(item.begin, data_size);
+            if (!mapped && !buffers->fits({size_t(data_size), stream_chunk_size})) {
+                on_log_error(std::format("too large to measure: {}", item.filename));
+                r.valid = false;
+                continue;
+            }
+
+            auto chunk = buffers->acquire(stream_chunk_size);
+
+            if (mapped) {
+                data = pak->mapping->data() + item.begin;
+            } else {
+                data_compressed = buffers->acquire(data_size);
+                file.seekg(item.begin);
+                file.read(data_compressed.data(), data_size);
+                data = data_compressed.data();
+            }
+
+            tasks.push_back(std::make_unique<worker_pool::group>(*workers));
+            tasks.back()->run([&, data, data_size, data_compressed = std::move(data_compressed), chunk = std::move(chunk)]() {
+                z_stream stream = {0};
+                stream.zalloc = Z_NULL;
+                stream.zfree = Z_NULL;
+                stream.opaque = Z_NULL;
+
+                auto const decode_start = clock::now();
+
+                auto res = inflateInit2(&stream, 31);
+                if (res < 0) {
+                    r.valid = false;
+                    return;
+                }
+
+                stream.avail_in = data_size;
+                stream.next_in = reinterpret_cast<unsigned char*>(const_cast<char*>(data));
+
+                // throughput only, output discarded
+                do {
+                    stream.avail_out = chunk.size();
+                    stream.next_out = reinterpret_cast<unsigned char*>(chunk.data());
+                    res = inflate(&stream, Z_NO_FLUSH);
+                } while (res == Z_OK);
+
+                r.decode_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - decode_start).count();
+                r.valid = (res == Z_STREAM_END) && (int64_t(stream.total_out) == item.size);
+                r.stored = stream.total_in;
+
+                inflateEnd(&stream);
+            });
+        }
+    }
+    std::chrono::duration<double> const duration = clock::now() - start_time;
+
+    struct totals {
+        int64_t items = 0;
+        int64_t size = 0;
+        int64_t stored = 0; // bytes in the pak
+        int64_t decode_ns = 0;
+
+        void add(int64_t item_size, int64_t item_stored, int64_t item_decode_ns) {
+            ++items;
+            size += item_size;
+            stored += item_stored;
+            decode_ns += item_decode_ns;
+        }
+
+        json to_json() const {
+            json j;
+            j["items"] = items;
+            j["size"] = size;
+            j["size_stored"] = stored;
+            j["ratio"] = size ? double(stored) / size : 1.0;
+            j["decode_ms"] = decode_ns / 1e6;
+            j["decode_ns_per_byte"] = size ? double(decode_ns) / size : 0.0;
+            return j;
+        }
+    };
+
+    totals all;
+    std::map<string, totals> directories;
+    std::map<string, totals> extensions;
+
+    auto j_files = json::array();
+    auto j_ineffective = json::array();
+    size_t failed = 0;
+
+    for (auto const& r : results) {
+        auto const& item = *r.item;
+        auto const stored = r.stored;
+
+        if (!r.valid) {
+            on_log_error(std::format("cannot decode: {}", item.filename));
+            ++failed;
+            continue;
+        }
+
+        fs::path const filename = item.filename;
+        all.add(item.size, stored, r.decode_ns);
+        directories[filename.parent_path().generic_string()].add(item.size, stored, r.decode_ns);
+        extensions[filename.extension().string()].add(item.size, stored, r.decode_ns);
+
+        auto const saving = item.size ? 1.0 - double(stored) / item.size : 0.0;
+
+        json j_file;
+        j_file["index"] = item.index;
+        j_file["filename"] = item.filename;
+        j_file["compressed"] = item.compressed;
+        j_file["size"] = item.size;
+        j_file["size_stored"] = stored;
+        j_file["ratio"] = 1.0 - saving;
+        j_file["decode_ns"] = r.decode_ns;
+        j_file["decode_ns_per_byte"] = item.size ? double(r.decode_ns) / item.size : 0.0;
+
+        if (item.compressed
+            && (saving < analyze_min_saving)
+            && (std::chrono::nanoseconds(r.decode_ns) >= analyze_min_decode))
+            j_ineffective.push_back(j_file);
+
+        j_files.push_back(std::move(j_file));
+    }
+
+    // most decode time first
+    std::sort(j_ineffective.begin(), j_ineffective.end(), [](json const& a, json const& b) {
+        return a["decode_ns"].get<int64_t>() > b["decode_ns"].get<int64_t>();
+    });
+
+    json j_directories;
+    for (auto const& [name, t] : directories)
+        j_directories[name.empty() ? "." : name] = t.to_json();
+
+    json j_extensions;
+    for (auto const& [name, t] : extensions)
+        j_extensions[name.empty() ? "(none)" : name] = t.to_json();
+
+    json j;
+    j["paker"] = plpaker_version;
+    j["pak"] = pak_file.string();
+    j["workers"] = workers->size();
+    j["wall_ms"] = duration.count() * 1e3;
+
+    j["total"] = all.to_json();
+    j["directories"] = j_directories;
+    j["extensions"] = j_extensions;
+    j["ineffective"] = j_ineffective;
+    j["files"] = j_files;
+
+    std::ofstream report(output_file);
+    if (!report) {
+        on_log_error(std::format("cannot write file: {}", output_file.string()));
+        return false;
+    }
+
+    auto const j_string = j.dump(4);
+    report.write(j_string.data(), j_string.size());
+
+    on_log_info(std::format("{} items in {:.2f}s - {:.2f} ns/byte, {} barely compressed",
+                            all.items,
+                            duration.count(),
+                            all.size ? double(all.decode_ns) / all.size : 0.0,
+                            j_ineffective.size()));
+
+    return failed == 0;
+}
+
+//-----------------------------------------------------------------------------
+bool paker::compress(fs::path const& input_file,
+                     fs::path const& output_file) const {
+    if (!options.best)
+        return compress_file(input_file, output_file, parameters.compression.value_or(compression_settings()), workers.get());
+
+    std::ifstream decompressed_file(input_file, std::ios::binary);
+    if (!decompressed_file)
+        return false;
+
+    decompressed_file.seekg(0, decompressed_file.end);
+    size_t const decompressed_size = decompressed_file.tellg();
+    decompressed_file.seekg(0, decompressed_file.beg);
+
+    if (!buffers->fits({decompressed_size, compress_bound(decompressed_size)})) {
+        on_log_info("too large for --best, default settings used");
+        return compress_file(input_file, output_file, parameters.compression.value_or(compression_settings()), workers.get());
+    }
+
+    auto decompressed_data = buffers->acquire(decompressed_size);
+    decompressed_file.read(decompressed_data.data(), decompressed_size);
+    decompressed_file.close();
+
+    auto settings = parameters.compression.value_or(compression_settings());
+
+    buffer_pool::buffer compressed_data;
+    if (!compress_best(decompressed_data.data(), decompressed_size, compressed_data, settings))
+        return false;
+
+    if (fs::exists(output_file))
+        fs::remove(output_file);
+
+    std::ofstream compressed_file(output_file, std::ios::binary);
+    if (!compressed_file)
+        return false;
+
+    compressed_file.write(compressed_data.data(), compressed_data.size());
+
+    compressed_file.close();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool paker::compress_best(char* const data,
+                          size_t data_size,
+                          buffer_pool::buffer& compressed_data,
+                          compression_settings& settings) const {
+    // start settings first, always finished
+    std::vector<compression_settings> candidates = {settings};
+    for (auto const& candidate : best_candidates) {
+        if (candidate != settings)
+            candidates.push_back(candidate);
+    }
+
+    auto const bound = compress_bound(data_size);
+
+    // the caller's input, the best stream and the candidates in flight fit the limit
+    size_t width = std::max<size_t>(workers->size(), 1);
+    if (buffers->limit) {
+        auto const held = buffer_pool::capacity(data_size) + buffer_pool::capacity(bound);
+        auto const slots = (buffers->limit > held) ? (buffers->limit - held) / buffer_pool::capacity(bound) : 0;
+        width = std::min(width, slots);
+    }
+
+    if (width == 0) { // room for one stream, no search
+        candidates.resize(1);
+        width = 1;
+    }
 
-        auto data_file = output_path;
-        data_file += fs::path::preferred_separator;
-        data_file += item.filename;
+    buffer_pool::buffer best;
+    size_t best_index = 0;
 
-        on_log_info(std::format("{} - {}", item.index, item.filename));
+    auto const deadline = clock::now() + std::chrono::milliseconds(parameters.best_time);
+    for (size_t first = 0; first < candidates.size(); first += width) {
+        if ((first > 0) && (clock::now() > deadline))
+            break;
 
-        auto const parent_path = data_file.parent_path();
-        if (!fs::exists(parent_path)) {
-            if (!fs::create_directories(parent_path)) {
-                on_log_error(std::format("cannot create folder: {}", parent_path.string()));
-                return false;
+        std::vector<buffer_pool::buffer> results(std::min(width, candidates.size() - first));
+        {
+            worker_pool::group tasks(*workers);
+            for (auto i = 0u; i < results.size(); ++i) {
+                tasks.run([&, i]() {
+                    auto const index = first + i;
+                    if ((index > 0) && (clock::now() > deadline))
+                        return;
+
+                    auto result = buffers->acquire(bound);
+
+                    size_t decompressed_data_size = data_size;
+                    size_t compressed_data_size = result.size();
+
+                    if (deflate_data(data,
+                                     decompressed_data_size,
+                                     result.data(),
+                                     compressed_data_size,
+                                     candidates[index],
+                                     index > 0 ? &deadline : nullptr)) {
+                        result.resize(compressed_data_size);
+                        results[i] = std::move(result);
+                    }
+                });
             }
+            tasks.wait();
         }
 
-        file.seekg(item.begin);
-        file.read(data_compressed.ptr, data_size);
+        // smaller streams that inflate back to the input win, the others are released
+        for (auto i = 0u; i < results.size(); ++i) {
+            auto& result = results[i];
+            if (result.data()
+                && (!best.data() || (result.size() < best.size()))
+                && inflates_to(result.data(), result.size(), data, data_size)) {
+                best = std::move(result);
+                best_index = first + i;
+            }
+            result.reset();
+        }
+    }
 
-        auto data = data_compressed.ptr;
+    if (!best.data())
+        return false;
 
-        auto data_target_file = data_file;
-        if (item.compressed)
-            data_target_file += compressed_extension;
+    settings = candidates[best_index];
+    compressed_data = std::move(best);
+    return true;
+}
 
-        std::ofstream target_file(data_target_file, std::ios::binary);
-        if (!target_file) {
-            on_log_error(std::format("cannot write file: {}", data_target_file.string()));
-            return false;
+//-----------------------------------------------------------------------------
+bool paker::auto_store(pak::item& item,
+                       fs::path const& file,
+                       store_report& report) const {
+    std::ifstream input(file, std::ios::binary);
+    if (!input)
+        return false;
+
+    input.seekg(0, input.end);
+    int64_t const size = input.tellg();
+
+    // small files whole, otherwise slices of begin, middle and end
+    auto sample = buffers->acquire(std::min<int64_t>(size, 3 * store_sample_size));
+    if (size_t(size) <= sample.size()) {
+        input.seekg(0);
+        input.read(sample.data(), size);
+    } else {
+        int64_t const offsets[] = {0, size / 2 - int64_t(store_sample_size) / 2, size - int64_t(store_sample_size)};
+        for (auto i = 0u; i < 3; ++i) {
+            input.seekg(offsets[i]);
+            input.read(sample.data() + i * store_sample_size, store_sample_size);
         }
+    }
 
-        target_file.write(data_compressed.ptr, data_size);
-        target_file.close();
+    if (!input)
+        return false;
 
-        if (item.compressed && options.decompress) {
-            size_t compressed_data_size = data_size;
-            size_t decompressed_data_size = max_data_size;
+    // order-0 entropy, bits per byte
+    size_t counts[256] = {};
+    for (auto i = 0u; i < sample.size(); ++i)
+        ++counts[static_cast<unsigned char>(sample.data()[i])];
 
-            if (!decompress_data(data_compressed.ptr,
-                                 compressed_data_size,
-                                 data_decompressed.ptr,
-                                 decompressed_data_size)) {
-                on_log_error(std::format("decompress file: {}", data_file.string()));
-                return false;
-            }
+    double entropy = 0.0;
+    for (auto const count : counts) {
+        if (count) {
+            auto const p = double(count) / sample.size();
+            entropy -= p * std::log2(p);
+        }
+    }
 
-            item.size_compressed = compressed_data_size;
+    // random-looking bytes leave deflate nothing to remove, no trial needed
+    if (entropy >= store_entropy) {
+        item.compressed = false;
+        item.size_compressed = 0;
 
-            std::ofstream decompressed_file(data_file, std::ios::binary);
-            if (!decompressed_file) {
-                on_log_error(std::format("cannot write file: {}", data_file.string()));
-                return false;
-            }
+        ++report.items;
+        ++report.untried;
+
+        on_log_info(std::format("{} - stored, {:.2f} bits/byte", item.filename, entropy));
+        return true;
+    }
 
-            decompressed_file.write(data_decompressed.ptr, decompressed_data_size);
-            decompressed_file.close();
+    auto compressed = buffers->acquire(compress_bound(sample.size()));
 
-            data = data_decompressed.ptr;
-        }
+    size_t sample_size = sample.size();
+    size_t compressed_size = compressed.size();
+    if (!compress_data(sample.data(), sample_size, compressed.data(), compressed_size, item_settings(item)))
+        return false;
+
+    // headers included, they count for small files
+    auto const saving = sample.size() ? 1.0 - double(compressed_size) / sample.size() : 0.0;
+    if (saving * 100.0 >= parameters.store_threshold) {
+        on_log_info(std::format("{} - compressed, compression saves {:.1f}% ({:.2f} bits/byte)",
+                                item.filename,
+                                saving * 100.0,
+                                entropy));
+        return false;
     }
 
-    file.close();
+    // what the game would pay for the whole item
+    size_t check_size = sample.size();
+    auto const decode_start = clock::now();
+    decompress_data(compressed.data(), compressed_size, sample.data(), check_size);
+    auto const decode_ns = std::chrono::duration<double, std::nano>(clock::now() - decode_start).count()
+                           * size / std::max<size_t>(sample.size(), 1);
+
+    item.compressed = false;
+    item.size_compressed = 0;
+
+    ++report.items;
+    report.bytes += int64_t(size * saving);
+    report.decode_ms += decode_ns / 1e6;
+
+    on_log_info(std::format("{} - stored, compression saves {:.1f}% ({:.2f} bits/byte), {:.3f} ms decode",
+                            item.filename,
+                            saving * 100.0,
+                            entropy,
+                            decode_ns / 1e6));
     return true;
 }
 
 //-----------------------------------------------------------------------------
-bool paker::pack(pak::ptr pak,
-                 fs::path const& input_path,
-                 fs::path const& output_file) const {
-    std::ofstream pak_file(output_file, std::ios::binary);
-    if (!pak_file) {
+void paker::log_auto_store(store_report const& report) const {
+    if (!options.auto_store)
+        return;
+
+    on_log_info(std::format("auto-store: {} items stored ({} by entropy), pak {:+} bytes, ~{:.2f} ms less decode",
+                            report.items,
+                            report.untried,
+                            report.bytes,
+                            report.decode_ms));
+}
+
+//-----------------------------------------------------------------------------
+compression_settings paker::item_settings(pak::item const& item) const {
+    if (parameters.compression)
+        return *parameters.compression;
+
+    return item.best.value_or(compression_settings());
+}
+
+//-----------------------------------------------------------------------------
+void paker::log_padding(int64_t padding, int64_t length) const {
+    if (parameters.align <= 1)
+        return;
+
+    on_log_info(std::format("aligned to {} bytes: {} bytes padding ({:.2f}% of {} bytes)",
+                            parameters.align,
+                            padding,
+                            length ? 100.0 * padding / length : 0.0,
+                            length));
+}
+
+//-----------------------------------------------------------------------------
+bool paker::watch(fs::path const& pak_file,
+                  fs::path const& output_file,
+                  fs::path const& mod_path,
+                  std::stop_token stop) const {
+    auto pak = pak::create();
+    if (!pak->parse(pak_file)) {
+        on_log_error(std::format("cannot parse file: {}", pak_file.string()));
+        return false;
+    }
+
+    auto const normalize = [](string name) {
+        std::replace(name.begin(), name.end(), '\\', '/');
+        return name;
+    };
+
+    std::map<string, size_t> names; // item by relative path
+    for (auto i = 0u; i < pak->items.size(); ++i)
+        names[normalize(pak->items[i].filename)] = i;
+
+    std::error_code ec;
+    fs::copy_file(pak_file, output_file, fs::copy_options::overwrite_existing, ec);
+    if (ec) {
         on_log_error(std::format("cannot write file: {}", output_file.string()));
         return false;
     }
 
-    int64_t const max_data_size = std::pow(2, std::ceil(std::log2(pak->max_size)));
-    scope_data data(max_data_size);
+    // data area in file order, the pak crc is combined from these
+    struct region {
+        int64_t length = 0;
+        uLong crc = 0;
+    };
+    std::map<int64_t, region> regions;
+    int64_t data_end = pak->index_begin;
+
+    {
+        std::set<int64_t> bounds = {0, data_end};
+        for (auto const& item : pak->items)
+            bounds.insert(item.begin);
+
+        std::ifstream input(output_file, std::ios::binary);
+        auto chunk = buffers->acquire(stream_chunk_size);
+
+        for (auto it = bounds.begin(); std::next(it) != bounds.end(); ++it) {
+            region r;
+            r.length = *std::next(it) - *it;
+            r.crc = crc32(0L, Z_NULL, 0);
+
+            for (auto remaining = r.length; remaining > 0;) {
+                auto const size = std::min<int64_t>(remaining, chunk.size());
+                if (!input.read(chunk.data(), size)) {
+                    on_log_error(std::format("cannot read file: {}", output_file.string()));
+                    return false;
+                }
+                r.crc = crc32(r.crc, reinterpret_cast<const Bytef*>(chunk.data()), size);
+                remaining -= size;
+            }
 
-    uLong crc = crc32(0L, Z_NULL, 0);
+            regions[*it] = r;
+        }
+    }
 
-    for (auto& item : pak->items) {
-        if (!valid_parameter(item))
-            continue;
+    static char const zeros[4096] = {};
+    auto const zeros_crc = [](uLong crc, int64_t size) {
+        for (; size > 0; size -= sizeof(zeros))
+            crc = update_crc(crc, zeros, std::min<int64_t>(size, sizeof(zeros)));
+        return crc;
+    };
 
-        on_log_info(std::format("{} - {}", item.index, item.filename));
+    // slots left by moved items, zeroed: parse sees them as padding of the
+    // item before, the next moved item that fits takes one
+    std::set<int64_t> free_slots;
 
-        auto data_file = input_path;
-        data_file += fs::path::preferred_separator;
-        data_file += item.filename;
+    // zero-length items own no slot, they share the begin of the data after them
+    // and move along when it goes, parse sorts them first
+    auto const follow = [&](int64_t from, int64_t to) {
+        for (auto& other : pak->items) {
+            if ((other.begin == from) && (other.end == other.begin))
+                other.begin = other.end = to;
+        }
+    };
 
-        auto data_target_file = data_file;
-        if (item.compressed)
-            data_target_file += compressed_extension;
+    // payload and zeros up to the slot length
+    auto const fill_slot = [&](std::ostream& output, int64_t begin, region& slot, char const* data, size_t size, uLong data_crc) {
+        int64_t const padding = slot.length - int64_t(size);
 
-        if (options.decompress && item.compressed) {
-            std::ifstream decompressed_file(data_file, std::ios::binary);
-            if (!decompressed_file) {
-                on_log_error(std::format("cannot read file: {}", data_file.string()));
-                return false;
+        output.seekp(begin);
+        output.write(data, size);
+        for (auto remaining = padding; remaining > 0; remaining -= sizeof(zeros))
+            output.write(zeros, std::min<int64_t>(remaining, sizeof(zeros)));
+
+        slot.crc = crc32_combine(data_crc, zeros_crc(crc32(0L, Z_NULL, 0), padding), padding);
+    };
+
+    auto const update = [&](dir_watcher::path_list const& files) -> bool {
+        auto const start_time = clock::now();
+
+        std::fstream output(output_file, std::ios::in | std::ios::out | std::ios::binary);
+        if (!output) {
+            on_log_error(std::format("cannot write file: {}", output_file.string()));
+            return false;
+        }
+
+        size_t updated = 0;
+        for (auto const& file : files) {
+            auto const name = normalize(fs::relative(file, mod_path, ec).generic_string());
+            auto const found = names.find(name);
+            if (found == names.end())
+                continue;
+
+            auto& item = pak->items[found->second];
+
+            std::ifstream input(file, std::ios::binary);
+            if (!input) // removed again
+                continue;
+
+            input.seekg(0, input.end);
+            size_t data_size = input.tellg();
+            input.seekg(0, input.beg);
+
+            auto data = buffers->acquire(data_size);
+            if (!input.read(data.data(), data_size))
+                continue;
+
+            auto payload = std::move(data);
+            if (item.compressed) {
+                auto compressed_data = buffers->acquire(compress_bound(data_size));
+                size_t compressed_data_size = compressed_data.size();
+
+                if (!compress_data(payload.data(),
+                                   data_size,
+                                   compressed_data.data(),
+                                   compressed_data_size,
+                                   item_settings(item))) {
+                    on_log_error(std::format("compress file: {}", file.string()));
+                    return false;
+                }
+
+                compressed_data.resize(compressed_data_size);
+                item.size_compressed = compressed_data_size;
+                payload = std::move(compressed_data);
             }
 
-            scope_data compressed_data(max_data_size);
-            size_t compressed_data_size = max_data_size;
+            item.size = data_size;
+
+            auto const payload_crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(payload.data()), payload.size());
+
+            // zero-length items have no slot to write in place
+            auto const found_slot = regions.find(item.begin);
+            bool const own_slot = (item.end > item.begin) && (found_slot != regions.end());
+
+            if (payload.size() == 0) { // empty, the slot is given up
+                if (own_slot && (item.begin + found_slot->second.length == data_end)) {
+                    regions.erase(found_slot);
+                    data_end = item.begin;
+                } else if (own_slot) {
+                    // next slot holding an item, free slots and padding have none
+                    auto next_begin = data_end;
+                    for (auto next = std::next(found_slot); next != regions.end(); ++next) {
+                        auto const holds_item = std::any_of(pak->items.begin(), pak->items.end(), [&](pak::item const& other) {
+                            return (other.begin == next->first) && (other.end > other.begin);
+                        });
+                        if (holds_item) {
+                            next_begin = next->first;
+                            break;
+                        }
+                    }
 
-            decompressed_file.seekg(0, decompressed_file.end);
-            size_t decompressed_size = decompressed_file.tellg();
-            decompressed_file.seekg(0, decompressed_file.beg);
+                    fill_slot(output, item.begin, found_slot->second, nullptr, 0, crc32(0L, Z_NULL, 0));
+                    free_slots.insert(item.begin);
 
-            decompressed_file.read(data.ptr, decompressed_size);
-            decompressed_file.close();
+                    item.end = item.begin;
+                    follow(item.begin, next_begin);
+                }
 
-            item.size = decompressed_size;
+                item.end = item.begin;
 
-            if (!compress_data(data.ptr,
-                               decompressed_size,
-                               compressed_data.ptr,
-                               compressed_data_size)) {
-                on_log_error(std::format("compress file: {}", data_file.string()));
-                return false;
+                on_log_info(std::format("{} - {}", item.index, item.filename));
+                ++updated;
+                continue;
             }
 
-            item.size_compressed = compressed_data_size;
+            region no_slot;
+            auto& slot = own_slot ? found_slot->second : no_slot;
 
-            if (fs::exists(data_target_file))
-                fs::remove(data_target_file);
+            if (own_slot && (item.begin + slot.length == data_end)) { // last one grows
+                output.seekp(item.begin);
+                output.write(payload.data(), payload.size());
 
-            std::ofstream compressed_file(data_target_file, std::ios::binary);
-            if (!compressed_file) {
-                on_log_error(std::format("cannot write file: {}", data_target_file.string()));
-                return false;
+                slot = {int64_t(payload.size()), payload_crc};
+                data_end = item.begin + slot.length;
+            } else if (own_slot && (int64_t(payload.size()) <= slot.length)) { // in place
+                fill_slot(output, item.begin, slot, payload.data(), payload.size(), payload_crc);
+            } else { // into a free slot or behind the data, an owned old one is freed
+                auto const old_begin = item.begin;
+
+                auto const free_slot = std::find_if(free_slots.begin(), free_slots.end(), [&](int64_t begin) {
+                    return int64_t(payload.size()) <= regions.at(begin).length;
+                });
+
+                if (free_slot != free_slots.end()) {
+                    item.begin = *free_slot;
+                    free_slots.erase(free_slot);
+
+                    fill_slot(output, item.begin, regions.at(item.begin), payload.data(), payload.size(), payload_crc);
+                } else {
+                    auto begin = data_end;
+                    if (parameters.align > 1)
+                        begin = (begin + parameters.align - 1) / parameters.align * parameters.align;
+
+                    if (begin > data_end) {
+                        follow(data_end, begin);
+
+                        output.seekp(data_end);
+                        for (auto remaining = begin - data_end; remaining > 0; remaining -= sizeof(zeros))
+                            output.write(zeros, std::min<int64_t>(remaining, sizeof(zeros)));
+
+                        regions[data_end] = {begin - data_end, zeros_crc(crc32(0L, Z_NULL, 0), begin - data_end)};
+                    }
+
+                    output.seekp(begin);
+                    output.write(payload.data(), payload.size());
+
+                    item.begin = begin;
+                    regions[begin] = {int64_t(payload.size()), payload_crc};
+                    data_end = begin + payload.size();
+                }
+
+                if (own_slot) {
+                    fill_slot(output, old_begin, slot, nullptr, 0, crc32(0L, Z_NULL, 0));
+                    free_slots.insert(old_begin);
+                    follow(old_begin, item.begin);
+                }
             }
 
-            compressed_file.write(compressed_data.ptr, compressed_data_size);
-            compressed_file.close();
+            item.end = item.begin + regions.at(item.begin).length;
+
+            on_log_info(std::format("{} - {}", item.index, item.filename));
+            ++updated;
         }
 
-        std::ifstream target_file(data_target_file, std::ios::binary);
-        if (!target_file) {
-            on_log_error(std::format("cannot read file: {}", data_target_file.string()));
+        if (updated == 0)
+            return true;
+
+        uLong crc = crc32(0L, Z_NULL, 0);
+        for (auto const& [pos, r] : regions)
+            crc = crc32_combine(crc, r.crc, r.length);
+
+        output.seekp(data_end);
+        write_index(pak, output, crc);
+        pak->index_begin = data_end;
+
+        int64_t const length = output.tellp();
+        output.close();
+
+        if (!output) {
+            on_log_error(std::format("cannot write file: {}", output_file.string()));
             return false;
         }
 
-        target_file.seekg(0, target_file.end);
-        size_t const target_size = target_file.tellg();
-        target_file.seekg(0, target_file.beg);
+        fs::resize_file(output_file, length, ec);
+        if (ec) {
+            on_log_error(std::format("cannot write file: {}", output_file.string()));
+            return false;
+        }
 
-        target_file.read(data.ptr, target_size);
+        std::chrono::duration<double, std::milli> const duration = clock::now() - start_time;
+        on_log_info(std::format("ready: {} files in {:.0f} ms", updated, duration.count()));
+        return true;
+    };
 
-        item.begin = pak_file.tellp();
+    auto watcher = dir_watcher::create(mod_path);
 
-        pak_file.write(data.ptr, target_size);
-        crc = crc32(crc, reinterpret_cast<const Bytef*>(data.ptr), target_size);
+    // mod files present at start
+    {
+        dir_watcher::path_list files;
+        for (fs::recursive_directory_iterator it(mod_path, ec), end; !ec && (it != end); it.increment(ec)) {
+            if (it->is_regular_file(ec))
+                files.push_back(it->path());
+        }
 
-        item.end = pak_file.tellp();
-    };
+        if (!update(files))
+            return false;
+    }
 
-    write_index(pak, pak_file, crc);
+    on_log_info(std::format("watching: {} ({})", mod_path.string(), watcher->backend()));
+
+    while (!stop.stop_requested()) {
+        auto const files = watcher->wait(watch_debounce, stop);
+        if (!files.empty() && !update(files))
+            return false;
+    }
 
-    pak_file.close();
     return true;
 }
 
 //-----------------------------------------------------------------------------
-bool paker::patch_files(fs::path const& pak_file,
-                        fs::path const& output_file,
-                        string_list const& files) const {
-    auto pak = pak::create();
-    if (!pak->parse(pak_file)) {
-        on_log_error(std::format("cannot parse file: {}", pak_file.string()));
+bool paker::run(fs::path const& manifest_file) const {
+    std::ifstream file(manifest_file, std::ios::binary);
+    if (!file) {
+        on_log_error(std::format("cannot read file: {}", manifest_file.string()));
         return false;
     }
 
-    std::ifstream input(pak_file, std::ios::binary);
-    if (!input) {
-        on_log_error(std::format("cannot read file: {}", pak_file.string()));
+    string const data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!json::accept(data)) {
+        on_log_error(std::format("invalid manifest: {}", manifest_file.string()));
         return false;
     }
 
-    std::ofstream output(output_file, std::ios::binary);
-    if (!output) {
-        on_log_error(std::format("cannot write file: {}", output_file.string()));
+    auto const j = json::parse(data);
+    auto const j_steps = j.is_array() ? j : (j.is_object() && j.contains("steps")) ? j["steps"] : json();
+    if (!j_steps.is_array()) {
+        on_log_error(std::format("invalid manifest, steps missing: {}", manifest_file.string()));
         return false;
     }
 
-    int64_t const max_data_size = std::pow(2, std::ceil(std::log2(pak->max_size)));
-    scope_data data(max_data_size);
-
-    uLong crc = crc32(0L, Z_NULL, 0);
+    // relative to the manifest
+    auto const base_path = fs::absolute(manifest_file).parent_path();
+    auto const resolve = [&](json const& j_step, char const* key) -> fs::path {
+        if (!j_step.contains(key) || !j_step[key].is_string())
+            return {};
 
-    for (auto& item : pak->items) {
-        bool patch = false;
+        fs::path path = j_step[key].get<string>();
+        if (path.is_relative())
+            path = base_path / path;
+        return fs::weakly_canonical(path);
+    };
 
-        for (auto const& file : files) {
-            if (item.filename.contains(fs::path(file).filename().string())) {
-                on_log_info(std::format("{} - {}", item.index, item.filename));
+    struct step {
+        json j;
+        string command;
 
-                if (item.compressed) {
-                    std::ifstream decompressed_file(file, std::ios::binary);
-                    if (!decompressed_file) {
-                        on_log_error(std::format("cannot read file: {}", file));
-                        return false;
-                    }
+        fs::path input;
+        fs::path output;
+        string_list files;
 
-                    scope_data decompressed_data(max_data_size);
-                    size_t compressed_data_size = max_data_size;
+        std::vector<fs::path> reads;
+        std::vector<fs::path> writes;
+        std::vector<size_t> after;
+    };
+    std::vector<step> steps;
 
-                    decompressed_file.seekg(0, decompressed_file.end);
-                    size_t decompressed_size = decompressed_file.tellg();
-                    decompressed_file.seekg(0, decompressed_file.beg);
+    for (auto const& j_step : j_steps) {
+        if (!j_step.is_object() || (j_step.contains("command") && !j_step["command"].is_string())) {
+            on_log_error(std::format("step {}: invalid step", steps.size() + 1));
+            return false;
+        }
 
-                    decompressed_file.read(decompressed_data.ptr, decompressed_size);
-                    decompressed_file.close();
+        step s;
+        s.j = j_step;
+        s.command = j_step.value("command", "");
+        s.input = resolve(j_step, "input");
+        s.output = resolve(j_step, "output");
 
-                    if (!compress_data(decompressed_data.ptr,
-                                       decompressed_size,
-                                       data.ptr,
-                                       compressed_data_size)) {
-                        on_log_error(std::format("compress file: {}", file));
-                        return false;
-                    }
+        if (s.input.empty() || s.output.empty()) {
+            on_log_error(std::format("step {}: input and output needed", steps.size() + 1));
+            return false;
+        }
 
-                    item.size_compressed = compressed_data_size;
-                    item.size = decompressed_size;
-                } else {
-                    std::ifstream uncompressed_file(file, std::ios::binary);
-                    if (!uncompressed_file) {
-                        on_log_error(std::format("cannot read file: {}", file));
-                        return false;
-                    }
+        s.reads.push_back(s.input);
+        s.writes.push_back(s.output);
 
-                    uncompressed_file.seekg(0, uncompressed_file.end);
-                    size_t uncompressed_size = uncompressed_file.tellg();
-                    uncompressed_file.seekg(0, uncompressed_file.beg);
+        if (s.command == "pack") // sidecars and pakinfo.json
+            s.writes.push_back(s.input.parent_path());
 
-                    uncompressed_file.read(data.ptr, uncompressed_size);
-                    uncompressed_file.close();
+        if (s.command == "patch") {
+            auto const j_files = j_step.value("files", json::array());
+            if (!j_files.is_array()) {
+                on_log_error(std::format("step {}: files must be a list", steps.size() + 1));
+                return false;
+            }
 
-                    item.size_compressed = uncompressed_size;
-                    item.size = uncompressed_size;
+            for (auto const& j_file : j_files) {
+                if (!j_file.is_string()) {
+                    on_log_error(std::format("step {}: invalid file: {}", steps.size() + 1, j_file.dump()));
+                    return false;
                 }
 
-                patch = true;
-                break;
+                fs::path path = j_file.get<string>();
+                if (path.is_relative())
+                    path = base_path / path;
+
+                s.files.push_back(fs::weakly_canonical(path).string());
+                s.reads.push_back(s.files.back());
             }
         }
 
-        int64_t data_size = 0;
-        if (patch) {
-            data_size = item.size_compressed;
-        } else {
-            data_size = item.end - item.begin;
+        string_list const commands = {"list", "unpack", "pack", "patch", "compress", "decompress"};
+        if (std::find(commands.begin(), commands.end(), s.command) == commands.end()) {
+            on_log_error(std::format("step {}: unknown command: {}", steps.size() + 1, s.command));
+            return false;
+        }
+
+        steps.push_back(std::move(s));
+    }
 
-            input.seekg(item.begin);
-            input.read(data.ptr, data_size);
+    // steps touching the same files run in manifest order
+    auto const overlap = [](fs::path const& a, fs::path const& b) {
+        auto const [it_a, it_b] = std::mismatch(a.begin(), a.end(), b.begin(), b.end());
+        return (it_a == a.end()) || (it_b == b.end());
+    };
+    auto const conflict = [&](std::vector<fs::path> const& a, std::vector<fs::path> const& b) {
+        for (auto const& path_a : a) {
+            for (auto const& path_b : b) {
+                if (overlap(path_a, path_b))
+                    return true;
+            }
         }
+        return false;
+    };
 
-        item.begin = output.tellp();
+    for (auto i = 0u; i < steps.size(); ++i) {
+        for (auto k = 0u; k < i; ++k) {
+            if (conflict(steps[k].writes, steps[i].reads)
+                || conflict(steps[k].writes, steps[i].writes)
+                || conflict(steps[k].reads, steps[i].writes))
+                steps[i].after.push_back(k);
+        }
+    }
 
-        output.write(data.ptr, data_size);
-        crc = crc32(crc, reinterpret_cast<const Bytef*>(data.ptr), data_size);
+    // parsed and mapped once until a step writes them, every step works on its own copy
+    std::mutex paks_mutex;
+    std::map<fs::path, std::shared_future<pak::ptr>> paks;
 
-        item.end = output.tellp();
+    auto const get_pak = [&](fs::path const& pak_file) -> pak::ptr {
+        std::promise<pak::ptr> parsed;
+        std::shared_future<pak::ptr> result;
+        {
+            std::lock_guard lock(paks_mutex);
+            auto const it = paks.find(pak_file);
+            if (it != paks.end())
+                result = it->second;
+            else
+                paks[pak_file] = parsed.get_future().share();
+        }
+
+        if (!result.valid()) {
+            auto pak = pak::create();
+            if (!pak->parse(pak_file))
+                pak = nullptr;
+            else
+                pak->map(pak_file);
+
+            parsed.set_value(pak);
+            return pak ? std::make_shared<pl::pak>(*pak) : nullptr;
+        }
+
+        auto const pak = result.get();
+        return pak ? std::make_shared<pl::pak>(*pak) : nullptr;
     };
 
-    write_index(pak, output, crc);
+    std::mutex log_mutex;
+
+    auto const run_step = [&](size_t index) -> bool {
+        auto const& s = steps[index];
+
+        // same pools, own settings
+        auto step_paker = *this;
+        step_paker.on_log_info = [&, index](string const& msg) {
+            std::lock_guard lock(log_mutex);
+            on_log_info(std::format("[{}] {}", index + 1, msg));
+        };
+        step_paker.on_log_error = [&, index](string const& msg) {
+            std::lock_guard lock(log_mutex);
+            on_log_error(std::format("[{}] {}", index + 1, msg));
+        };
+
+        auto& o = step_paker.options;
+        o.compress = s.j.value("compress", o.compress);
+        o.decompress = s.j.value("decompress", o.decompress);
+        o.best = s.j.value("best", o.best);
+        o.resume = s.j.value("resume", o.resume);
+        o.sync = s.j.value("sync", o.sync);
+        o.auto_store = s.j.value("auto_store", o.auto_store);
+        o.direct = s.j.value("direct", o.direct);
+
+        auto& p = step_paker.parameters;
+        p.start = s.j.value("start", p.start);
+        p.end = s.j.value("end", p.end);
+        p.filter = s.j.value("filter", p.filter);
+        p.align = s.j.value("align", p.align);
+        p.best_time = s.j.value("best_time", p.best_time);
+        p.store_threshold = s.j.value("store_threshold", p.store_threshold);
+
+        if (s.j.count("level") || s.j.count("strategy")) {
+            compression_settings settings;
+            settings.level = s.j.value("level", settings.level);
+            settings.strategy = s.j.value("strategy", settings.strategy);
+            p.compression = settings;
+        }
 
-    output.close();
-    input.close();
-    return true;
+        std::error_code ec;
+        if (s.command != "list")
+            fs::create_directories(s.command == "unpack" ? s.output : s.output.parent_path(), ec);
+
+        if (s.command == "list") {
+            auto pak = get_pak(s.input);
+            fs::create_directories(s.output, ec);
+            return pak && pak->write_info(s.output);
+        }
+
+        if (s.command == "unpack") {
+            auto pak = get_pak(s.input);
+            if (!pak) {
+                step_paker.on_log_error(std::format("cannot parse file: {}", s.input.string()));
+                return false;
+            }
+
+            if (s.j.value("clean", !o.resume && !o.sync)) {
+                fs::remove_all(s.output, ec);
+                fs::create_directories(s.output, ec);
+            }
+
+            return step_paker.unpack(pak, s.input, s.output) && pak->write_info(s.output);
+        }
+
+        if (s.command == "pack") {
+            auto pak = pak::create();
+            if (!pak->load(s.input)) {
+                step_paker.on_log_error(std::format("cannot load file: {}", s.input.string()));
+                return false;
+            }
+
+            return step_paker.pack(pak, s.input.parent_path(), s.output);
+        }
+
+        if (s.command == "patch") {
+            auto pak = get_pak(s.input);
+            if (!pak) {
+                step_paker.on_log_error(std::format("cannot parse file: {}", s.input.string()));
+                return false;
+            }
+
+            return step_paker.patch_files(pak, s.input, s.output, s.files);
+        }
+
+        if (s.command == "compress")
+            return step_paker.compress(s.input, s.output);
+
+        return decompress_file(s.input, s.output);
+    };
+
+    auto const start_time = clock::now();
+
+    std::vector<std::promise<bool>> done(steps.size());
+    std::vector<std::shared_future<bool>> results;
+    for (auto& d : done)
+        results.push_back(d.get_future().share());
+
+    // as many steps running as workers, streaming ones check fits() against the
+    // whole limit, so under a memory limit they take turns
+    std::counting_semaphore<> slots(std::ptrdiff_t(workers->size()));
+    std::mutex stream_mutex;
+
+    auto const streams = [&](size_t index) {
+        auto const& command = steps[index].command;
+        return (buffers->limit != 0) && ((command == "unpack") || (command == "pack") || (command == "patch"));
+    };
+
+    // own threads, steps block on their inputs
+    std::vector<std::thread> threads;
+    for (auto i = 0u; i < steps.size(); ++i) {
+        threads.emplace_back([&, i]() {
+            bool ready = true;
+            for (auto const k : steps[i].after)
+                ready = results[k].get() && ready;
+
+            bool result = false;
+            if (!ready) {
+                std::lock_guard lock(log_mutex);
+                on_log_error(std::format("[{}] skipped, previous step failed", i + 1));
+            } else {
+                std::unique_lock stream_lock(stream_mutex, std::defer_lock);
+                if (streams(i))
+                    stream_lock.lock();
+
+                slots.acquire();
+                try {
+                    result = run_step(i);
+                } catch (std::exception const& e) {
+                    std::lock_guard lock(log_mutex);
+                    on_log_error(std::format("[{}] {}", i + 1, e.what()));
+                }
+                slots.release();
+            }
+
+            // rewritten paks are parsed again by later steps
+            {
+                std::lock_guard lock(paks_mutex);
+                std::erase_if(paks, [&](auto const& entry) {
+                    return std::any_of(steps[i].writes.begin(), steps[i].writes.end(), [&](fs::path const& path) {
+                        return overlap(entry.first, path);
+                    });
+                });
+            }
+
+            done[i].set_value(result);
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    auto const failed = std::count_if(results.begin(), results.end(), [](auto const& result) {
+        return !result.get();
+    });
+
+    std::chrono::duration<double> const duration = clock::now() - start_time;
+    on_log_info(std::format("{} steps in {:.2f}s, {} failed", steps.size(), duration.count(), failed));
+    return failed == 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -1,16 +1,40 @@
 #pragma once
 
+#include "pool.hpp"
+#include <cstdio>
 #include <filesystem>
 #include <functional>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stop_token>
 #include <string>
 #include <vector>
+#include <version>
+
+#ifdef __cpp_lib_generator
+    #include <generator>
+#endif
 
 namespace pl {
 
+struct checkpoint_index;
+struct mapped_file;
+struct pak_writer;
+
 namespace fs = std::filesystem;
 using string = std::string;
 using string_list = std::vector<string>;
 
+struct compression_settings {
+    int level = -1;    // Z_DEFAULT_COMPRESSION
+    int strategy = 0;  // Z_DEFAULT_STRATEGY
+    int mem_level = 8; // deflate state memory
+
+    bool operator==(compression_settings const&) const = default;
+};
+
 struct pak {
     using ptr = std::shared_ptr<pak>;
     using list = std::vector<ptr>;
@@ -33,6 +57,8 @@ struct pak {
 
         int64_t size = 0;            // target data size (decompressed)
         int64_t size_compressed = 0; // without header/padding
+
+        std::optional<compression_settings> best; // --best winner
     };
 
     item::list items;     // pak info
@@ -49,19 +75,28 @@ struct pak {
     int32_t version = 0; // increment
     int32_t count = 0;   // items size
 
+    std::shared_ptr<mapped_file> mapping;          // optional item data
+    std::shared_ptr<checkpoint_index> checkpoints; // read: loaded on first use
+
     bool parse(fs::path const& pak_file);
+    bool map(fs::path const& pak_file);
     bool load(fs::path const& pakinfo_file);
 
     bool write_info(fs::path const& output_path) const;
+    string info() const; // pakinfo.json content
 };
 
 bool compress_data(char* const decompressed_data,
                    size_t& decompressed_data_size,
                    char* compressed_data,
-                   size_t& compressed_data_size);
+                   size_t& compressed_data_size,
+                   compression_settings const& settings = {});
 
+// parallel blocks for large files if workers are given
 bool compress_file(fs::path const& input_file,
-                   fs::path const& output_file);
+                   fs::path const& output_file,
+                   compression_settings const& settings = {},
+                   worker_pool* workers = nullptr);
 
 bool decompress_data(char* const compressed_data,
                      size_t& compressed_data_size,
@@ -71,6 +106,38 @@ bool decompress_data(char* const compressed_data,
 bool decompress_file(fs::path const& input_file,
                      fs::path const& output_file);
 
+// piece of an item's data, valid until the next chunk is requested
+struct item_chunk {
+    pak::item const* item = nullptr;
+    std::span<char const> data;
+
+    int64_t offset = 0; // in the item data
+    bool last = false;  // item complete, empty items have one chunk
+};
+
+// items chunk by chunk, inflated on the way through two fixed buffers
+struct item_reader {
+    item_reader(pak::ptr pak,
+                fs::path const& pak_file,
+                std::vector<pak::item const*> items,
+                bool decompress,
+                buffer_pool& buffers,
+                size_t chunk_size = 1 << 20);
+    ~item_reader();
+
+    item_reader(item_reader&&) noexcept;
+    item_reader& operator=(item_reader&&) noexcept;
+
+    // false at the end or on errors
+    bool next(item_chunk& chunk);
+
+    string error;
+
+private:
+    struct state;
+    std::unique_ptr<state> s;
+};
+
 struct paker {
     string version;
 
@@ -80,9 +147,18 @@ struct paker {
 
     pak::list paks;
 
+    worker_pool::ptr workers; // shared by all commands
+    buffer_pool::ptr buffers; // recycled item data
+
     struct options {
         bool compress = true;
         bool decompress = true;
+        bool best = false;   // search compression settings
+        bool resume = false; // unpack: keep journaled items
+        bool sync = false;   // unpack: rewrite changed items only
+
+        bool auto_store = false; // pack/patch: store what barely compresses
+        bool direct = false;     // pack/patch: O_DIRECT output
     };
     options options;
 
@@ -90,6 +166,20 @@ struct paker {
         uint32_t start = 0;
         uint32_t end = 0;
         string filter;
+
+        std::optional<compression_settings> compression; // --level/--strategy
+        uint32_t best_time = 1000;                       // ms per item
+
+        uint32_t align = 0; // item begin, power of two
+
+        fs::path rules; // build: compression per file
+
+        uint32_t store_threshold = 10; // --auto-store, minimum saving in %
+
+        uint32_t checkpoint_span = 4 << 20; // index: output between checkpoints
+
+        int64_t offset = 0;  // cat: item range
+        int64_t length = -1; // to the end if negative
     };
     parameters parameters;
 
@@ -99,14 +189,112 @@ struct paker {
                 fs::path const& pak_file,
                 fs::path const& output_path) const;
 
+    // --sync: remove files the pak no longer has, write pakchanges.json
+    bool sync_changes(pak::ptr pak,
+                      fs::path const& output_path,
+                      string_list const& added,
+                      string_list const& changed,
+                      string_list& removed) const;
+
     bool pack(pak::ptr pak,
               fs::path const& input_path,
               fs::path const& output_file) const;
 
+    // pak straight from a folder, no pakinfo.json or sidecars
+    bool build(fs::path const& input_path,
+               fs::path const& output_file) const;
+
     bool patch_files(fs::path const& pak_file,
                      fs::path const& output_file,
                      string_list const& files) const;
 
+    bool patch_files(pak::ptr pak,
+                     fs::path const& pak_file,
+                     fs::path const& output_file,
+                     string_list const& files) const;
+
+    bool run(fs::path const& manifest_file) const;
+
+    bool watch(fs::path const& pak_file,
+               fs::path const& output_file,
+               fs::path const& mod_path,
+               std::stop_token stop = {}) const;
+
+    bool cat(pak::ptr pak,
+             fs::path const& pak_file,
+             string const& filename,
+             std::FILE* output) const;
+
+    pak::item const* find_item(pak::ptr pak,
+                               string const& filename) const;
+
+    // zran-style inflate checkpoints of large compressed items, <pak>.zran
+    bool index(pak::ptr pak,
+               fs::path const& pak_file) const;
+
+    // item data range, inflated from the nearest checkpoint if indexed
+    bool read(pak::ptr pak,
+              fs::path const& pak_file,
+              string const& filename,
+              int64_t offset,
+              int64_t length,
+              buffer_pool::buffer& data) const;
+
+    // items passing start/end/filter, decompressed unless only -c is set
+    item_reader read_items(pak::ptr pak,
+                           fs::path const& pak_file) const;
+
+#ifdef __cpp_lib_generator
+    // lazy read_items, stopping early releases the buffers; error is set when
+    // the items end early, it has to outlive the generator, the path is copied
+    std::generator<item_chunk const&> items(pak::ptr pak,
+                                            fs::path pak_file,
+                                            string& error) const;
+#endif
+
+    // tar stream of the items, decompressed unless only -c is set
+    bool export_tar(pak::ptr pak,
+                    fs::path const& pak_file,
+                    std::FILE* output) const;
+
+    bool import_tar(std::istream& input,
+                    fs::path const& output_file) const;
+
+    // decode cost and compression gain per item, directory and extension
+    bool analyze(pak::ptr pak,
+                 fs::path const& pak_file,
+                 fs::path const& output_file) const;
+
+    bool compress(fs::path const& input_file,
+                  fs::path const& output_file) const;
+
+    bool compress_best(char* const data,
+                       size_t data_size,
+                       buffer_pool::buffer& compressed_data,
+                       compression_settings& settings) const;
+
+    struct store_report {
+        size_t items = 0;     // stored instead of compressed
+        size_t untried = 0;   // of these by entropy alone, not in bytes and decode
+        int64_t bytes = 0;    // larger pak
+        double decode_ms = 0; // less inflate
+    };
+
+    // sample compression, false if the item stays compressed
+    bool auto_store(pak::item& item,
+                    fs::path const& file,
+                    store_report& report) const;
+
+    void log_auto_store(store_report const& report) const;
+
+    compression_settings item_settings(pak::item const& item) const;
+
+    void log_padding(int64_t padding, int64_t length) const;
+
+    // preallocated output of pack/patch, nullptr if it cannot be created
+    std::unique_ptr<pak_writer> open_pak(fs::path const& output_file,
+                                         int64_t expected_size) const;
+
     bool valid_parameter(pak::item const& item) const;
 };
 
@@ -0,0 +1,258 @@
+#include "pool.hpp"
+#include <algorithm>
+#include <bit>
+
+namespace pl {
+
+//-----------------------------------------------------------------------------
+worker_pool::group::group(worker_pool& pool)
+: pool(pool) {
+}
+
+//-----------------------------------------------------------------------------
+worker_pool::group::~group() {
+    wait();
+}
+
+//-----------------------------------------------------------------------------
+void worker_pool::group::run(task&& func) {
+    {
+        std::lock_guard lock(pool.mutex);
+        pool.start();
+
+        ++pending;
+        pool.queue.push_back({std::move(func), this});
+    }
+    pool.cv_task.notify_one();
+}
+
+//-----------------------------------------------------------------------------
+void worker_pool::group::wait() {
+    std::unique_lock lock(pool.mutex);
+    while (pending > 0) {
+        if (pool.queue.empty()) {
+            pool.cv_done.wait(lock);
+            continue;
+        }
+
+        // nested groups must not block the workers they wait for
+        auto e = std::move(pool.queue.front());
+        pool.queue.pop_front();
+
+        lock.unlock();
+        pool.execute(e);
+        lock.lock();
+    }
+}
+
+//-----------------------------------------------------------------------------
+worker_pool::worker_pool(size_t count)
+: count(count) {
+    if (this->count == 0)
+        this->count = std::max(1u, std::thread::hardware_concurrency());
+}
+
+//-----------------------------------------------------------------------------
+worker_pool::~worker_pool() {
+    {
+        std::lock_guard lock(mutex);
+        stop = true;
+    }
+    cv_task.notify_all();
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+//-----------------------------------------------------------------------------
+void worker_pool::start() {
+    if (!threads.empty())
+        return;
+
+    for (auto i = 0u; i < count; ++i)
+        threads.emplace_back([this]() { loop(); });
+}
+
+//-----------------------------------------------------------------------------
+void worker_pool::execute(entry& e) {
+    e.func();
+
+    {
+        std::lock_guard lock(mutex);
+        --e.owner->pending;
+    }
+    cv_done.notify_all();
+}
+
+//-----------------------------------------------------------------------------
+void worker_pool::loop() {
+    std::unique_lock lock(mutex);
+    for (;;) {
+        cv_task.wait(lock, [this]() { return stop || !queue.empty(); });
+        if (queue.empty())
+            return;
+
+        auto e = std::move(queue.front());
+        queue.pop_front();
+
+        lock.unlock();
+        execute(e);
+        lock.lock();
+    }
+}
+
+//-----------------------------------------------------------------------------
+buffer_pool::buffer::~buffer() {
+    reset();
+}
+
+//-----------------------------------------------------------------------------
+buffer_pool::buffer::buffer(buffer&& other) noexcept
+: pool(other.pool), storage(std::move(other.storage)), length(other.length), size_class(other.size_class) {
+    other.pool = nullptr;
+    other.length = 0;
+}
+
+//-----------------------------------------------------------------------------
+buffer_pool::buffer& buffer_pool::buffer::operator=(buffer&& other) noexcept {
+    if (this != &other) {
+        reset();
+
+        pool = other.pool;
+        storage = std::move(other.storage);
+        length = other.length;
+        size_class = other.size_class;
+
+        other.pool = nullptr;
+        other.length = 0;
+    }
+    return *this;
+}
+
+//-----------------------------------------------------------------------------
+void buffer_pool::buffer::resize(size_t size) {
+    length = std::min(size, capacity());
+}
+
+//-----------------------------------------------------------------------------
+void buffer_pool::buffer::reset() {
+    if (pool && storage)
+        pool->release(*this);
+
+    pool = nullptr;
+    storage.reset();
+    length = 0;
+}
+
+//-----------------------------------------------------------------------------
+void buffer_pool::buffer::leak() {
+    if (pool && storage) {
+        (void)storage.release();
+        pool->release(*this);
+    }
+
+    pool = nullptr;
+    length = 0;
+}
+
+//-----------------------------------------------------------------------------
+buffer_pool::buffer_pool(size_t limit)
+: limit(limit) {
+}
+
+//-----------------------------------------------------------------------------
+buffer_pool::~buffer_pool() {
+}
+
+//-----------------------------------------------------------------------------
+size_t buffer_pool::capacity(size_t size) {
+    auto const size_class = std::max<uint32_t>(min_class, std::bit_width(size ? size - 1 : 0));
+    return size_t(1) << size_class;
+}
+
+//-----------------------------------------------------------------------------
+bool buffer_pool::fits(std::initializer_list<size_t> sizes) const {
+    if (limit == 0)
+        return true;
+
+    size_t total = 0;
+    for (auto const size : sizes)
+        total += capacity(size);
+
+    return total <= limit;
+}
+
+//-----------------------------------------------------------------------------
+buffer_pool::buffer buffer_pool::acquire(size_t size, reclaim_func const& reclaim) {
+    buffer b;
+    b.pool = this;
+    b.length = size;
+    b.size_class = std::max<uint32_t>(min_class, std::bit_width(size ? size - 1 : 0));
+
+    auto const bytes = b.capacity();
+    auto const over_limit = [&]() {
+        return (limit != 0) && (in_flight > 0) && (in_flight + bytes > limit);
+    };
+
+    std::unique_lock lock(mutex);
+    while (over_limit()) {
+        lock.unlock();
+        bool const progress = reclaim && reclaim();
+        lock.lock();
+
+        if (!progress && over_limit())
+            cv.wait(lock);
+    }
+
+    in_flight += bytes;
+    peak = std::max(peak, in_flight);
+
+    if ((b.size_class < free_list.size()) && !free_list[b.size_class].empty()) {
+        b.storage = std::move(free_list[b.size_class].back());
+        free_list[b.size_class].pop_back();
+        cached -= bytes;
+        return b;
+    }
+
+    if (limit != 0)
+        trim(limit - std::min(limit, in_flight));
+
+    lock.unlock();
+    b.storage.reset(new char[bytes]);
+    return b;
+}
+
+//-----------------------------------------------------------------------------
+void buffer_pool::release(buffer& b) {
+    auto const bytes = b.capacity();
+    std::unique_ptr<char[]> storage;
+    {
+        std::lock_guard lock(mutex);
+        in_flight -= bytes;
+
+        auto const max_idle = limit ? std::min(max_cached, limit - std::min(limit, in_flight)) : max_cached;
+        if (b.storage && (cached + bytes <= max_idle)) {
+            if (free_list.size() <= b.size_class)
+                free_list.resize(b.size_class + 1);
+
+            free_list[b.size_class].push_back(std::move(b.storage));
+            cached += bytes;
+        } else {
+            storage = std::move(b.storage); // freed outside the lock
+        }
+    }
+    cv.notify_all();
+}
+
+//-----------------------------------------------------------------------------
+void buffer_pool::trim(size_t bytes) {
+    for (auto size_class = free_list.size(); (size_class > 0) && (cached > bytes); --size_class) {
+        auto& list = free_list[size_class - 1];
+        while (!list.empty() && (cached > bytes)) {
+            list.pop_back();
+            cached -= size_t(1) << (size_class - 1);
+        }
+    }
+}
+
+} // namespace pl
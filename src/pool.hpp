@@ -0,0 +1,142 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pl {
+
+struct worker_pool {
+    using ptr = std::shared_ptr<worker_pool>;
+    using task = std::move_only_function<void()>;
+
+    static ptr create(size_t count = 0) {
+        return std::make_shared<worker_pool>(count);
+    }
+
+    // tasks pushed together, waited on together
+    struct group {
+        explicit group(worker_pool& pool);
+        ~group();
+
+        void run(task&& func);
+        void wait(); // helps executing queued tasks
+
+    private:
+        friend worker_pool;
+
+        worker_pool& pool;
+        size_t pending = 0; // guarded by pool.mutex
+    };
+
+    explicit worker_pool(size_t count = 0); // 0 = hardware threads
+    ~worker_pool();
+
+    worker_pool(worker_pool const&) = delete;
+    worker_pool& operator=(worker_pool const&) = delete;
+
+    size_t size() const {
+        return count;
+    }
+
+private:
+    struct entry {
+        task func;
+        group* owner = nullptr;
+    };
+
+    void start(); // threads on first use
+    void execute(entry& e);
+    void loop();
+
+    size_t count = 0;
+    bool stop = false;
+
+    std::mutex mutex;
+    std::condition_variable cv_task;
+    std::condition_variable cv_done;
+
+    std::deque<entry> queue;
+    std::vector<std::thread> threads;
+};
+
+struct buffer_pool {
+    using ptr = std::shared_ptr<buffer_pool>;
+    using reclaim_func = std::function<bool()>; // false if nothing to wait for
+
+    static ptr create(size_t limit = 0) {
+        return std::make_shared<buffer_pool>(limit);
+    }
+
+    // recycled storage, returned to the pool on destruction
+    struct buffer {
+        buffer() = default;
+        ~buffer();
+
+        buffer(buffer&& other) noexcept;
+        buffer& operator=(buffer&& other) noexcept;
+
+        char* data() const {
+            return storage.get();
+        }
+
+        size_t size() const {
+            return length;
+        }
+
+        size_t capacity() const {
+            return size_t(1) << size_class;
+        }
+
+        void resize(size_t size); // within capacity
+        void reset();
+        void leak(); // storage never freed, still in use elsewhere; the pool forgets it
+
+    private:
+        friend buffer_pool;
+
+        buffer_pool* pool = nullptr;
+        std::unique_ptr<char[]> storage;
+        size_t length = 0;
+        uint32_t size_class = 0;
+    };
+
+    explicit buffer_pool(size_t limit = 0); // 0 = unlimited
+    ~buffer_pool();
+
+    buffer_pool(buffer_pool const&) = delete;
+    buffer_pool& operator=(buffer_pool const&) = delete;
+
+    // waits while over the limit, reclaim drives the holders meanwhile
+    buffer acquire(size_t size, reclaim_func const& reclaim = {});
+
+    // false if the buffers cannot be in flight together
+    bool fits(std::initializer_list<size_t> sizes) const;
+
+    static size_t capacity(size_t size);
+
+    size_t limit = 0; // in flight bytes
+    size_t peak = 0;  // in flight maximum
+
+private:
+    void release(buffer& b);
+    void trim(size_t bytes); // free cached buffers
+
+    static constexpr uint32_t min_class = 12; // 4 KB
+    static constexpr size_t max_cached = 256 << 20;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    size_t in_flight = 0;
+    size_t cached = 0;
+    std::vector<std::vector<std::unique_ptr<char[]>>> free_list; // per class
+};
+
+} // namespace pl
@@ -0,0 +1,206 @@
+#include "tar.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+
+namespace pl::tar {
+
+// https://www.gnu.org/software/tar/manual/html_node/Standard.html
+struct ustar_header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type;
+    char link_name[100];
+    char magic[6];
+    char version[2];
+    char user_name[32];
+    char group_name[32];
+    char dev_major[8];
+    char dev_minor[8];
+    char prefix[155];
+    char pad[12];
+};
+static_assert(sizeof(ustar_header) == block_size);
+
+//-----------------------------------------------------------------------------
+// octal, base-256 if it does not fit
+void write_number(char* field, size_t length, uint64_t value) {
+    if (value < (uint64_t(1) << (3 * (length - 1)))) {
+        auto const text = std::format("{:0{}o}", value, length - 1);
+        std::memcpy(field, text.data(), length - 1);
+        field[length - 1] = '\0';
+        return;
+    }
+
+    for (auto i = length; i-- > 1;) {
+        field[i] = char(value & 0xff);
+        value >>= 8;
+    }
+    field[0] = char(0x80);
+}
+
+//-----------------------------------------------------------------------------
+uint64_t read_number(char const* field, size_t length) {
+    uint64_t value = 0;
+
+    if (static_cast<unsigned char>(field[0]) & 0x80) {
+        for (auto i = 1u; i < length; ++i)
+            value = (value << 8) | static_cast<unsigned char>(field[i]);
+        return value;
+    }
+
+    for (auto i = 0u; i < length; ++i) {
+        if ((field[i] < '0') || (field[i] > '7')) {
+            if (value || (field[i] != ' '))
+                break;
+            continue; // leading spaces
+        }
+        value = (value << 3) | uint64_t(field[i] - '0');
+    }
+    return value;
+}
+
+//-----------------------------------------------------------------------------
+void finish(ustar_header& h) {
+    std::memcpy(h.magic, "ustar", 6);
+    std::memcpy(h.version, "00", 2);
+
+    std::memset(h.checksum, ' ', sizeof(h.checksum));
+
+    auto const bytes = reinterpret_cast<unsigned char const*>(&h);
+    uint32_t sum = 0;
+    for (auto i = 0u; i < sizeof(h); ++i)
+        sum += bytes[i];
+
+    write_number(h.checksum, 7, sum);
+}
+
+//-----------------------------------------------------------------------------
+bool valid(ustar_header const& h) {
+    ustar_header copy = h;
+    std::memset(copy.checksum, ' ', sizeof(copy.checksum));
+
+    auto const bytes = reinterpret_cast<unsigned char const*>(&copy);
+    uint32_t sum = 0;
+    for (auto i = 0u; i < sizeof(copy); ++i)
+        sum += bytes[i];
+
+    return sum == read_number(h.checksum, sizeof(h.checksum));
+}
+
+//-----------------------------------------------------------------------------
+std::string header(std::string const& name, uint64_t size, int64_t mtime) {
+    std::string result;
+
+    ustar_header h = {};
+    if (name.size() > sizeof(h.name)) { // GNU long name
+        ustar_header l = {};
+        std::memcpy(l.name, "././@LongLink", 13);
+        write_number(l.mode, sizeof(l.mode), 0644);
+        write_number(l.uid, sizeof(l.uid), 0);
+        write_number(l.gid, sizeof(l.gid), 0);
+        write_number(l.size, sizeof(l.size), name.size() + 1);
+        write_number(l.mtime, sizeof(l.mtime), 0);
+        l.type = 'L';
+        finish(l);
+
+        result.append(reinterpret_cast<char const*>(&l), sizeof(l));
+        result.append(name.c_str(), name.size() + 1);
+        result.append(padding(name.size() + 1), '\0');
+    }
+
+    std::memcpy(h.name, name.data(), std::min(name.size(), sizeof(h.name)));
+    write_number(h.mode, sizeof(h.mode), 0644);
+    write_number(h.uid, sizeof(h.uid), 0);
+    write_number(h.gid, sizeof(h.gid), 0);
+    write_number(h.size, sizeof(h.size), size);
+    write_number(h.mtime, sizeof(h.mtime), uint64_t(std::max<int64_t>(mtime, 0)));
+    h.type = '0';
+    finish(h);
+
+    result.append(reinterpret_cast<char const*>(&h), sizeof(h));
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+std::string end() {
+    return std::string(2 * block_size, '\0');
+}
+
+//-----------------------------------------------------------------------------
+bool reader::next(entry& e) {
+    std::string long_name;
+
+    for (;;) {
+        if (skip && !input.ignore(skip)) {
+            error = "truncated entry";
+            return false;
+        }
+        skip = 0;
+
+        ustar_header h;
+        if (!input.read(reinterpret_cast<char*>(&h), sizeof(h))) {
+            error = "truncated archive";
+            return false;
+        }
+
+        if (h.name[0] == '\0') // end blocks
+            return false;
+
+        if (!valid(h)) {
+            error = "invalid header";
+            return false;
+        }
+
+        e.type = h.type;
+        e.size = read_number(h.size, sizeof(h.size));
+
+        if ((e.type == 'L') || (e.type == 'x')) {
+            std::string data(e.size, '\0');
+            if (!input.read(data.data(), e.size)) {
+                error = "truncated header";
+                return false;
+            }
+            skip = padding(e.size);
+
+            if (e.type == 'L') {
+                long_name = data.c_str();
+                continue;
+            }
+
+            // pax records: "<length> <key>=<value>\n"
+            for (size_t pos = 0; pos < data.size();) {
+                auto const length = std::strtoull(data.c_str() + pos, nullptr, 10);
+                if ((length == 0) || (pos + length > data.size()))
+                    break;
+
+                auto const record = data.substr(pos, length - 1);
+                auto const key = record.find(" path=");
+                if (key != std::string::npos)
+                    long_name = record.substr(key + 6);
+
+                pos += length;
+            }
+            continue;
+        }
+
+        if (!long_name.empty()) {
+            e.name = long_name;
+        } else {
+            e.name.assign(h.name, strnlen(h.name, sizeof(h.name)));
+            if (h.prefix[0] && (std::memcmp(h.magic, "ustar", 5) == 0))
+                e.name = std::string(h.prefix, strnlen(h.prefix, sizeof(h.prefix))) + "/" + e.name;
+        }
+
+        skip = e.size + padding(e.size);
+        return true;
+    }
+}
+
+} // namespace pl::tar
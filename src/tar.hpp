@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+
+namespace pl::tar {
+
+constexpr size_t block_size = 512;
+
+inline size_t padding(uint64_t size) {
+    return (block_size - size % block_size) % block_size;
+}
+
+// ustar header of a regular file, GNU long name block before if needed
+std::string header(std::string const& name, uint64_t size, int64_t mtime);
+
+// two zero blocks
+std::string end();
+
+struct entry {
+    std::string name;
+    uint64_t size = 0;
+    char type = '0';
+
+    bool regular() const {
+        return (type == '0') || (type == '\0');
+    }
+};
+
+// sequential entries, data is read by the caller from input
+struct reader {
+    explicit reader(std::istream& input)
+    : input(input) {
+    }
+
+    // skips the unread rest of the previous entry, false at the end or on errors
+    bool next(entry& e);
+
+    // data bytes taken from input since next()
+    void consume(uint64_t size) {
+        skip -= std::min(skip, size);
+    }
+
+    std::istream& input;
+    std::string error;
+
+private:
+    uint64_t skip = 0; // data and padding of the current entry
+};
+
+} // namespace pl::tar
@@ -0,0 +1,130 @@
+#include "trace.hpp"
+#include "nlohmann/json.hpp"
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pl::trace {
+using json = nlohmann::json;
+using clock = std::chrono::steady_clock;
+
+constexpr size_t ring_size = 1 << 16; // spans per thread, oldest overwritten
+
+struct event {
+    char const* name = nullptr;
+    std::string detail; // capacity reused once the ring wrapped
+    int64_t begin = 0;
+    int64_t end = 0;
+};
+
+// filled by its thread only, read when the work is done
+struct ring {
+    std::vector<event> events = std::vector<event>(ring_size);
+    std::atomic<uint64_t> head = 0;
+    uint32_t id = 0;
+};
+
+clock::time_point epoch;
+
+std::mutex rings_mutex; // registration and output
+std::vector<std::shared_ptr<ring>> rings;
+
+//-----------------------------------------------------------------------------
+ring& local_ring() {
+    // the list keeps rings of finished threads
+    thread_local auto const local = []() {
+        auto result = std::make_shared<ring>();
+
+        std::lock_guard lock(rings_mutex);
+        result->id = uint32_t(rings.size());
+        rings.push_back(result);
+        return result;
+    }();
+
+    return *local;
+}
+
+//-----------------------------------------------------------------------------
+void start() {
+    epoch = clock::now();
+    local_ring();
+
+    active.store(true, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - epoch).count();
+}
+
+//-----------------------------------------------------------------------------
+void record(char const* name, std::string_view detail, int64_t begin, int64_t end) {
+    auto& r = local_ring();
+
+    auto const head = r.head.load(std::memory_order_relaxed);
+    auto& e = r.events[head % ring_size];
+    e.name = name;
+    e.detail.assign(detail);
+    e.begin = begin;
+    e.end = end;
+
+    r.head.store(head + 1, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+bool write(fs::path const& file, size_t& events, size_t& dropped) {
+    events = 0;
+    dropped = 0;
+
+    auto j_events = json::array();
+    j_events.push_back({{"ph", "M"}, {"name", "process_name"}, {"pid", 1}, {"tid", 0}, {"args", {{"name", "plpaker"}}}});
+
+    std::lock_guard lock(rings_mutex);
+    for (auto const& r : rings) {
+        auto const head = r->head.load(std::memory_order_acquire);
+        auto const count = std::min<uint64_t>(head, ring_size);
+
+        events += count;
+        dropped += head - count;
+
+        auto const thread_name = r->id ? std::format("worker {}", r->id) : std::string("main");
+        j_events.push_back({{"ph", "M"}, {"name", "thread_name"}, {"pid", 1}, {"tid", r->id}, {"args", {{"name", thread_name}}}});
+
+        for (auto i = head - count; i < head; ++i) {
+            auto const& e = r->events[i % ring_size];
+
+            json j_event;
+            j_event["name"] = e.name;
+            j_event["ph"] = "X";
+            j_event["pid"] = 1;
+            j_event["tid"] = r->id;
+            j_event["ts"] = e.begin / 1000.0; // us
+            j_event["dur"] = (e.end - e.begin) / 1000.0;
+
+            if (!e.detail.empty())
+                j_event["args"]["file"] = e.detail;
+
+            j_events.push_back(std::move(j_event));
+        }
+    }
+
+    json j;
+    j["traceEvents"] = std::move(j_events);
+    j["displayTimeUnit"] = "ms";
+
+    std::ofstream output(file);
+    if (!output)
+        return false;
+
+    auto const j_string = j.dump(-1, ' ', false, json::error_handler_t::replace);
+    output.write(j_string.data(), j_string.size());
+
+    return bool(output);
+}
+
+} // namespace pl::trace
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace pl::trace {
+
+namespace fs = std::filesystem;
+
+inline std::atomic<bool> active = false; // --trace
+
+// spans are recorded from now on, the calling thread is "main"
+void start();
+
+// chrome trace event json of all threads, spans lost to full rings are dropped
+bool write(fs::path const& file, size_t& events, size_t& dropped);
+
+int64_t now(); // ns since start
+
+void record(char const* name, std::string_view detail, int64_t begin, int64_t end);
+
+// duration of the enclosing scope on the calling thread, name must be a literal
+struct span {
+    explicit span(char const* name, std::string_view detail = {}) {
+        if (active.load(std::memory_order_acquire)) {
+            this->name = name;
+            this->detail = detail;
+            begin = now();
+        }
+    }
+
+    template <std::same_as<fs::path> Path> // no string conversions
+    span(char const* name, Path const& file) {
+        if (active.load(std::memory_order_acquire)) {
+            this->name = name;
+            detail = file.string();
+            begin = now();
+        }
+    }
+
+    ~span() {
+        if (name)
+            record(name, detail, begin, now());
+    }
+
+    span(span const&) = delete;
+    span& operator=(span const&) = delete;
+
+private:
+    char const* name = nullptr;
+    std::string detail; // copied while tracing only
+    int64_t begin = 0;
+};
+
+} // namespace pl::trace
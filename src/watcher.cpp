@@ -0,0 +1,205 @@
+#include "watcher.hpp"
+#include <map>
+#include <set>
+#include <thread>
+
+#if defined(__linux__)
+    #include <poll.h>
+    #include <sys/inotify.h>
+    #include <unistd.h>
+    #define PLPAK_INOTIFY 1
+#endif
+
+namespace pl {
+
+using clock = std::chrono::steady_clock;
+
+constexpr std::chrono::milliseconds watch_tick(100); // stop check
+
+struct poll_watcher : dir_watcher {
+    struct state {
+        fs::file_time_type time;
+        uintmax_t size = 0;
+
+        bool operator==(state const&) const = default;
+    };
+    using snapshot = std::map<fs::path, state>;
+
+    explicit poll_watcher(fs::path const& path)
+    : path(path), files(scan()) {
+    }
+
+    snapshot scan() const {
+        snapshot result;
+
+        std::error_code ec;
+        for (fs::recursive_directory_iterator it(path, ec), end; !ec && (it != end); it.increment(ec)) {
+            if (!it->is_regular_file(ec))
+                continue;
+
+            state s;
+            s.time = it->last_write_time(ec);
+            s.size = it->file_size(ec);
+            result[it->path()] = s;
+        }
+
+        return result;
+    }
+
+    path_list wait(std::chrono::milliseconds debounce,
+                   std::stop_token stop) override {
+        std::set<fs::path> changed;
+        auto quiet_since = clock::now();
+
+        while (!stop.stop_requested()) {
+            std::this_thread::sleep_for(std::max(watch_tick, debounce / 2));
+
+            auto current = scan();
+            bool any = false;
+            for (auto const& [file, s] : current) {
+                auto const it = files.find(file);
+                if ((it == files.end()) || !(it->second == s)) {
+                    changed.insert(file);
+                    any = true;
+                }
+            }
+            files = std::move(current);
+
+            if (any)
+                quiet_since = clock::now();
+            else if (!changed.empty() && (clock::now() - quiet_since >= debounce))
+                break;
+        }
+
+        return {changed.begin(), changed.end()};
+    }
+
+    char const* backend() const override {
+        return "polling";
+    }
+
+    fs::path path;
+    snapshot files;
+};
+
+#ifdef PLPAK_INOTIFY
+
+struct inotify_watcher : dir_watcher {
+    static constexpr uint32_t file_mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+
+    ~inotify_watcher() override {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool setup(fs::path const& path) {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        return add_tree(path, nullptr);
+    }
+
+    // folder and its subfolders, new files are reported as changed
+    bool add_tree(fs::path const& path, std::set<fs::path>* changed) {
+        if (!add(path))
+            return false;
+
+        std::error_code ec;
+        for (fs::recursive_directory_iterator it(path, ec), end; !ec && (it != end); it.increment(ec)) {
+            if (it->is_directory(ec))
+                add(it->path());
+            else if (changed && it->is_regular_file(ec))
+                changed->insert(it->path());
+        }
+
+        return true;
+    }
+
+    bool add(fs::path const& path) {
+        auto const wd = inotify_add_watch(fd, path.c_str(), file_mask);
+        if (wd < 0)
+            return false;
+
+        folders[wd] = path;
+        return true;
+    }
+
+    // false on queue overflow
+    bool read_events(std::set<fs::path>& changed) {
+        alignas(inotify_event) char buffer[64 * 1024];
+
+        for (;;) {
+            auto const length = read(fd, buffer, sizeof(buffer));
+            if (length <= 0)
+                return true;
+
+            for (auto pos = buffer; pos < buffer + length;) {
+                auto const event = reinterpret_cast<inotify_event const*>(pos);
+                pos += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW)
+                    return false;
+
+                auto const folder = folders.find(event->wd);
+                if ((folder == folders.end()) || (event->len == 0))
+                    continue;
+
+                auto const file = folder->second / event->name;
+                if (event->mask & IN_ISDIR) {
+                    if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                        add_tree(file, &changed);
+                } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                    changed.insert(file);
+                }
+            }
+        }
+    }
+
+    path_list wait(std::chrono::milliseconds debounce,
+                   std::stop_token stop) override {
+        std::set<fs::path> changed;
+        auto quiet_since = clock::now();
+
+        while (!stop.stop_requested()) {
+            auto const timeout = changed.empty() ? watch_tick : std::min(watch_tick, debounce);
+
+            pollfd p = {fd, POLLIN, 0};
+            auto const res = poll(&p, 1, int(timeout.count()));
+
+            if (res > 0) {
+                if (!read_events(changed)) { // lost events, everything
+                    for (auto const& [wd, folder] : folders)
+                        add_tree(folder, &changed);
+                }
+                quiet_since = clock::now();
+            } else if (!changed.empty() && (clock::now() - quiet_since >= debounce)) {
+                break;
+            }
+        }
+
+        return {changed.begin(), changed.end()};
+    }
+
+    char const* backend() const override {
+        return "inotify";
+    }
+
+    int fd = -1;
+    std::map<int, fs::path> folders;
+};
+
+#endif
+
+//-----------------------------------------------------------------------------
+dir_watcher::ptr dir_watcher::create(fs::path const& path) {
+#ifdef PLPAK_INOTIFY
+    auto watcher = std::make_unique<inotify_watcher>();
+    if (watcher->setup(path))
+        return watcher;
+#endif
+
+    return std::make_unique<poll_watcher>(path);
+}
+
+} // namespace pl
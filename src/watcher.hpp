@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <stop_token>
+#include <vector>
+
+namespace pl {
+
+namespace fs = std::filesystem;
+
+// changed files below a folder
+struct dir_watcher {
+    using ptr = std::unique_ptr<dir_watcher>;
+    using path_list = std::vector<fs::path>;
+
+    // inotify on Linux, polling otherwise
+    static ptr create(fs::path const& path);
+
+    virtual ~dir_watcher() = default;
+
+    // blocks until files changed and stayed quiet for the debounce time
+    virtual path_list wait(std::chrono::milliseconds debounce,
+                           std::stop_token stop) = 0;
+
+    virtual char const* backend() const = 0;
+};
+
+} // namespace pl
@@ -0,0 +1,727 @@
+#include "writer.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <fstream>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+    #include <fcntl.h>
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #define PLPAK_IO_URING 1
+#endif
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace pl {
+
+struct pool_writer : file_writer {
+    explicit pool_writer(worker_pool::ptr workers)
+    : workers(workers), tasks(*workers) {
+    }
+
+    ~pool_writer() override {
+        flush();
+    }
+
+    void write(fs::path const& file, data&& content) override {
+        auto const size = content.size();
+        {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [&]() { return (bytes == 0) || (bytes + size <= max_bytes); });
+            bytes += size;
+            ++queued;
+        }
+
+        tasks.run([this, file, content = std::move(content), position = next_file()]() mutable {
+            bool ok = false;
+            {
+                trace::span span("write", file);
+
+                std::ofstream stream(file, std::ios::binary);
+                ok = stream && stream.write(content.data(), content.size());
+            }
+
+            auto const size = content.size();
+            content.reset();
+
+            {
+                std::lock_guard lock(mutex);
+                bytes -= size;
+                --queued;
+                ++done;
+
+                if (ok)
+                    ++files;
+                else if (error.empty())
+                    error = std::format("cannot write file: {}", file.string());
+            }
+            file_done(position, ok);
+            cv.notify_all();
+        });
+    }
+
+    bool wait() override {
+        std::unique_lock lock(mutex);
+        if (queued == 0)
+            return false;
+
+        auto const count = done;
+        cv.wait(lock, [&]() { return done != count; });
+        return true;
+    }
+
+    bool flush() override {
+        tasks.wait();
+        return error.empty();
+    }
+
+    char const* backend() const override {
+        return "threads";
+    }
+
+    worker_pool::ptr workers;
+    worker_pool::group tasks;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t bytes = 0;
+    size_t queued = 0;
+    size_t done = 0;
+};
+
+#ifdef PLPAK_IO_URING
+
+struct uring_writer : file_writer {
+    static constexpr unsigned entries = 256; // one op per job in flight
+    static constexpr unsigned batch = 32;    // ops per submit
+
+    enum class state { open,
+                       write,
+                       close };
+
+    struct job {
+        std::string path;
+        data content;
+        size_t written = 0;
+        size_t position = 0; // in the queue
+        int fd = -1;
+        bool ok = true;
+        bool busy = false; // an op in the ring
+        state step = state::open;
+    };
+
+    ~uring_writer() override {
+        if (ring < 0)
+            return;
+
+        flush();
+
+        if (sqes)
+            munmap(sqes, sqes_size);
+        if (cq_ptr && (cq_ptr != sq_ptr))
+            munmap(cq_ptr, cq_size);
+        if (sq_ptr)
+            munmap(sq_ptr, sq_size);
+
+        close(ring);
+    }
+
+    bool setup() {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+
+        ring = syscall(__NR_io_uring_setup, entries, &params);
+        if (ring < 0)
+            return false;
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+        bool const single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            sq_size = cq_size = std::max(sq_size, cq_size);
+
+        sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) {
+            sq_ptr = nullptr;
+            return false;
+        }
+
+        cq_ptr = single ? sq_ptr : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            cq_ptr = nullptr;
+            return false;
+        }
+
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        auto const sqes_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+        if (sqes_ptr == MAP_FAILED)
+            return false;
+        sqes = static_cast<io_uring_sqe*>(sqes_ptr);
+
+        auto const sq = static_cast<char*>(sq_ptr);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries = params.sq_entries;
+
+        auto const cq = static_cast<char*>(cq_ptr);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        if (!supported({IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE}))
+            return false;
+
+        jobs.resize(sq_entries);
+        for (auto slot = sq_entries; slot > 0; --slot)
+            free_slots.push_back(slot - 1);
+
+        return true;
+    }
+
+    bool supported(std::initializer_list<int> ops) const {
+        constexpr unsigned ops_count = 256;
+        std::vector<char> buffer(sizeof(io_uring_probe) + ops_count * sizeof(io_uring_probe_op), 0);
+
+        auto const probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+        if (syscall(__NR_io_uring_register, ring, IORING_REGISTER_PROBE, probe, ops_count) < 0)
+            return false;
+
+        for (auto const op : ops) {
+            if ((op > probe->last_op) || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                return false;
+        }
+
+        return true;
+    }
+
+    void write(fs::path const& file, data&& content) override {
+        if (!dead) // completions of leaked jobs are left in the ring
+            reap();
+
+        while (!dead && (free_slots.empty() || ((active > 0) && (bytes + content.size() > max_bytes))))
+            advance(1);
+
+        if (dead) { // error is set already
+            content.reset();
+            file_done(next_file(), false);
+            return;
+        }
+
+        auto const slot = free_slots.back();
+        free_slots.pop_back();
+
+        auto& j = jobs[slot];
+        j = job();
+        j.path = file.string();
+        j.content = std::move(content);
+        j.position = next_file();
+
+        ++active;
+        bytes += j.content.size();
+
+        auto sqe = next_sqe(slot);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(j.path.c_str());
+        sqe->len = 0644;
+        sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+        if (pending >= batch)
+            advance(0);
+    }
+
+    bool wait() override {
+        if (active == 0)
+            return false;
+
+        advance(1);
+        return true;
+    }
+
+    bool flush() override {
+        while (active > 0)
+            advance(1);
+
+        return error.empty();
+    }
+
+    char const* backend() const override {
+        return "io_uring";
+    }
+
+    io_uring_sqe* next_sqe(unsigned slot) {
+        auto const tail = *sq_tail;
+        auto const index = tail & sq_mask;
+
+        auto sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->user_data = slot;
+        jobs[slot].busy = true;
+
+        sq_array[index] = index;
+        std::atomic_ref(*sq_tail).store(tail + 1, std::memory_order_release);
+
+        ++pending;
+        return sqe;
+    }
+
+    // submit queued ops and wait for some completions
+    void advance(unsigned min_complete) {
+        trace::span span(min_complete ? "io wait" : "io submit");
+
+        for (;;) {
+            auto const flags = min_complete ? IORING_ENTER_GETEVENTS : 0u;
+            auto const res = syscall(__NR_io_uring_enter, ring, pending, min_complete, flags, nullptr, 0);
+            if (res >= 0) {
+                pending -= res;
+                break;
+            }
+
+            if (errno == EBUSY) { // completion queue full
+                reap();
+                continue;
+            }
+
+            if (errno != EINTR) {
+                if (error.empty())
+                    error = std::format("cannot submit io: {}", std::strerror(errno));
+                abort_all();
+                return;
+            }
+        }
+
+        reap();
+    }
+
+    void reap() {
+        auto head = *cq_head;
+        while (head != std::atomic_ref(*cq_tail).load(std::memory_order_acquire)) {
+            auto const& cqe = cqes[head & cq_mask];
+            complete(static_cast<unsigned>(cqe.user_data), cqe.res);
+            ++head;
+        }
+        std::atomic_ref(*cq_head).store(head, std::memory_order_release);
+    }
+
+    void complete(unsigned slot, int res) {
+        auto& j = jobs[slot];
+        j.busy = false;
+
+        if (dead) { // draining, the fd is all that is left to close
+            if (j.step == state::open)
+                j.fd = std::max(res, -1);
+            else if (j.step == state::close)
+                j.fd = -1;
+            return;
+        }
+
+        switch (j.step) {
+            case state::open:
+                if (res < 0) {
+                    fail(j, -res);
+                    release(slot);
+                    return;
+                }
+
+                j.fd = res;
+                if (j.content.size() == 0)
+                    submit_close(slot);
+                else
+                    submit_write(slot);
+                return;
+
+            case state::write:
+                if (res <= 0) {
+                    fail(j, res < 0 ? -res : EIO);
+                    submit_close(slot);
+                    return;
+                }
+
+                j.written += res;
+                if (j.written < j.content.size())
+                    submit_write(slot); // short write
+                else
+                    submit_close(slot);
+                return;
+
+            case state::close:
+                if (res < 0)
+                    fail(j, -res);
+                if (j.ok)
+                    ++files;
+
+                release(slot);
+                return;
+        }
+    }
+
+    void submit_write(unsigned slot) {
+        auto& j = jobs[slot];
+        j.step = state::write;
+
+        auto const remaining = j.content.size() - j.written;
+
+        auto sqe = next_sqe(slot);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = j.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(j.content.data() + j.written);
+        sqe->len = static_cast<uint32_t>(std::min<size_t>(remaining, 1u << 30));
+        sqe->off = j.written;
+    }
+
+    void submit_close(unsigned slot) {
+        auto& j = jobs[slot];
+        j.step = state::close;
+
+        auto sqe = next_sqe(slot);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = j.fd;
+    }
+
+    void release(unsigned slot) {
+        auto& j = jobs[slot];
+        bytes -= j.content.size();
+        j.content.reset();
+        file_done(j.position, j.ok);
+
+        --active;
+        free_slots.push_back(slot);
+    }
+
+    void fail(job& j, int err) {
+        j.ok = false;
+        if (error.empty())
+            error = std::format("cannot write file: {} ({})", j.path, std::strerror(err));
+    }
+
+    // ring unusable: ops the kernel has not taken are dropped, the others are
+    // waited for; if that fails too their paths and buffers are leaked
+    void abort_all() {
+        dead = true;
+
+        auto const head = std::atomic_ref(*sq_head).load(std::memory_order_acquire);
+        for (auto tail = *sq_tail; tail != head; --tail)
+            jobs[sqes[(tail - 1) & sq_mask].user_data].busy = false;
+        std::atomic_ref(*sq_tail).store(head, std::memory_order_release);
+        pending = 0;
+
+        auto const busy = [&]() {
+            return std::any_of(jobs.begin(), jobs.end(), [](job const& j) { return j.busy; });
+        };
+
+        while (busy()) {
+            auto const res = syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if ((res < 0) && (errno != EINTR) && (errno != EBUSY))
+                break;
+            reap();
+        }
+
+        std::vector<bool> used(jobs.size(), true);
+        for (auto const slot : free_slots)
+            used[slot] = false;
+
+        bool leaked = false;
+        for (auto slot = 0u; slot < jobs.size(); ++slot) {
+            auto& j = jobs[slot];
+            if (!used[slot])
+                continue;
+
+            if (j.busy) {
+                j.content.leak();
+                leaked = true;
+            } else {
+                if (j.fd >= 0)
+                    close(j.fd);
+                j.content.reset();
+            }
+
+            file_done(j.position, false);
+        }
+
+        if (leaked)
+            new std::vector<job>(std::move(jobs)); // paths in the ring stay valid, never freed
+
+        jobs.clear();
+        free_slots.clear();
+        active = 0;
+        bytes = 0;
+    }
+
+    int ring = -1;
+    unsigned pending = 0; // queued, not submitted
+    bool dead = false;    // submit failed, files are refused
+
+    void* sq_ptr = nullptr;
+    size_t sq_size = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+
+    io_uring_sqe* sqes = nullptr;
+    size_t sqes_size = 0;
+
+    void* cq_ptr = nullptr;
+    size_t cq_size = 0;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    std::vector<job> jobs;
+    std::vector<unsigned> free_slots;
+    size_t active = 0;
+    size_t bytes = 0;
+};
+
+#endif
+
+//-----------------------------------------------------------------------------
+size_t file_writer::queued_files() const {
+    std::lock_guard lock(positions_mutex);
+    return positions;
+}
+
+//-----------------------------------------------------------------------------
+size_t file_writer::done_files() const {
+    std::lock_guard lock(positions_mutex);
+    return done_prefix;
+}
+
+//-----------------------------------------------------------------------------
+size_t file_writer::next_file() {
+    std::lock_guard lock(positions_mutex);
+    return positions++;
+}
+
+//-----------------------------------------------------------------------------
+void file_writer::file_done(size_t position, bool ok) {
+    if (!ok)
+        return;
+
+    std::lock_guard lock(positions_mutex);
+    done_ahead.insert(position);
+    while (!done_ahead.empty() && (*done_ahead.begin() == done_prefix)) {
+        done_ahead.erase(done_ahead.begin());
+        ++done_prefix;
+    }
+}
+
+//-----------------------------------------------------------------------------
+file_writer::ptr file_writer::create(worker_pool::ptr workers) {
+#ifdef PLPAK_IO_URING
+    if (!std::getenv("PLPAK_NO_IO_URING")) {
+        auto writer = std::make_unique<uring_writer>();
+        if (writer->setup())
+            return writer;
+    }
+#endif
+
+    return std::make_unique<pool_writer>(workers);
+}
+
+//-----------------------------------------------------------------------------
+pak_writer::ptr pak_writer::open(fs::path const& file, int64_t expected_size, bool direct) {
+    ptr result(new pak_writer());
+
+#ifdef _WIN32
+    result->file = _wfopen(file.c_str(), L"wb");
+    if (!result->file)
+        return nullptr;
+#else
+    auto const flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    #ifdef O_DIRECT
+    if (direct) {
+        result->fd = ::open(file.c_str(), flags | O_DIRECT, 0644);
+        result->direct = (result->fd >= 0);
+    }
+    #endif
+
+    if (result->fd < 0) // no O_DIRECT on this file system
+        result->fd = ::open(file.c_str(), flags, 0644);
+    if (result->fd < 0)
+        return nullptr;
+
+    #ifdef __linux__
+    if (expected_size > 0)
+        fallocate(result->fd, 0, 0, expected_size); // best effort, trimmed on close
+    #endif
+#endif
+
+    for (auto& buffer : result->buffers)
+        buffer.reset(new (std::align_val_t(direct_alignment)) char[block_size]);
+
+    result->setp(result->buffers[0].get(), result->buffers[0].get() + block_size);
+    result->thread = std::thread([writer = result.get()]() { writer->loop(); });
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+pak_writer::~pak_writer() {
+    close();
+}
+
+//-----------------------------------------------------------------------------
+bool pak_writer::close() {
+    if (closed)
+        return error.empty();
+    closed = true;
+
+#ifdef _WIN32
+    if (!file)
+        return false;
+#else
+    if (fd < 0)
+        return false;
+#endif
+
+    {
+        std::unique_lock lock(mutex); // direct may have been dropped meanwhile
+        cv.wait(lock, [&]() { return !pending; });
+    }
+
+    auto const final_size = size();
+    auto tail = size_t(pptr() - pbase());
+
+    // direct writes are whole sectors, the padding is trimmed below
+    if (direct && (tail % direct_alignment)) {
+        auto const padded = (tail + direct_alignment - 1) / direct_alignment * direct_alignment;
+        std::memset(pptr(), 0, padded - tail);
+        tail = padded;
+    }
+
+    if (tail)
+        submit(tail);
+
+    {
+        std::lock_guard lock(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    if (thread.joinable())
+        thread.join();
+
+#ifdef _WIN32
+    if (std::fclose(file) != 0 && error.empty())
+        error = "cannot close file";
+#else
+    if ((ftruncate(fd, final_size) != 0) && error.empty())
+        error = std::format("cannot trim file: {}", std::strerror(errno));
+
+    if ((::close(fd) != 0) && error.empty())
+        error = std::format("cannot close file: {}", std::strerror(errno));
+#endif
+
+    setp(nullptr, nullptr);
+    return error.empty();
+}
+
+//-----------------------------------------------------------------------------
+pak_writer::int_type pak_writer::overflow(int_type ch) {
+    if (closed || !submit(pptr() - pbase()))
+        return traits_type::eof();
+
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+
+    return traits_type::not_eof(ch);
+}
+
+//-----------------------------------------------------------------------------
+pak_writer::pos_type pak_writer::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    if ((off != 0) || (dir != std::ios_base::cur) || !(which & std::ios_base::out))
+        return pos_type(off_type(-1)); // tellp only
+
+    return pos_type(size());
+}
+
+//-----------------------------------------------------------------------------
+bool pak_writer::submit(size_t size) {
+    std::unique_lock lock(mutex);
+    cv.wait(lock, [&]() { return !pending; });
+
+    if (!error.empty())
+        return false;
+
+    pending = pbase();
+    pending_size = size;
+    pending_offset = submitted;
+    submitted += size;
+    lock.unlock();
+    cv.notify_all();
+
+    fill ^= 1;
+    setp(buffers[fill].get(), buffers[fill].get() + block_size);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+void pak_writer::loop() {
+    std::unique_lock lock(mutex);
+    for (;;) {
+        cv.wait(lock, [&]() { return pending || stop; });
+        if (!pending)
+            return;
+
+        lock.unlock();
+        bool const ok = write_block(pending, pending_size, pending_offset);
+        lock.lock();
+
+        if (!ok && error.empty())
+            error = std::format("cannot write file: {}", std::strerror(errno));
+
+        pending = nullptr;
+        cv.notify_all();
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool pak_writer::write_block(char const* data, size_t size, int64_t offset) {
+    trace::span span("pak write");
+
+#ifdef _WIN32
+    return std::fwrite(data, 1, size, file) == size;
+#else
+    while (size > 0) {
+        auto const res = pwrite(fd, data, size, offset);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+
+    #ifdef O_DIRECT
+            if ((errno == EINVAL) && direct) { // refused despite open, page cache then
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+                direct = false;
+                continue;
+            }
+    #endif
+            return false;
+        }
+
+        data += res;
+        size -= res;
+        offset += res;
+    }
+    return true;
+#endif
+}
+
+} // namespace pl
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "pool.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <set>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+namespace pl {
+
+namespace fs = std::filesystem;
+
+// asynchronous output of many small files
+struct file_writer {
+    using ptr = std::unique_ptr<file_writer>;
+    using data = buffer_pool::buffer;
+
+    // io_uring if the kernel supports it, worker pool otherwise
+    static ptr create(worker_pool::ptr workers);
+
+    virtual ~file_writer() = default;
+
+    // queue file, data is released when written
+    virtual void write(fs::path const& file, data&& content) = 0;
+
+    // wait for one queued file, false if none
+    virtual bool wait() = 0;
+
+    // wait for all queued files
+    virtual bool flush() = 0;
+
+    virtual char const* backend() const = 0;
+
+    // files queued so far, the first done_files() of them are all written,
+    // a failed one stops the count
+    size_t queued_files() const;
+    size_t done_files() const;
+
+    size_t files = 0;           // written
+    std::string error;          // first failure
+    size_t max_bytes = 64 << 20; // in flight
+
+protected:
+    size_t next_file(); // queue position of a new file
+    void file_done(size_t position, bool ok);
+
+private:
+    mutable std::mutex positions_mutex;
+    size_t positions = 0;
+    size_t done_prefix = 0;
+    std::set<size_t> done_ahead; // written before earlier files
+};
+
+// one large sequential file: preallocated, offsets counted here, full blocks
+// written by a second thread while the other buffer fills
+struct pak_writer : std::streambuf {
+    using ptr = std::unique_ptr<pak_writer>;
+
+    static constexpr size_t block_size = 4 << 20;
+    static constexpr size_t direct_alignment = 4096;
+
+    // expected size is reserved up front, direct bypasses the page cache if supported,
+    // nullptr if the file cannot be created
+    static ptr open(fs::path const& file, int64_t expected_size = 0, bool direct = false);
+
+    ~pak_writer() override;
+
+    pak_writer(pak_writer const&) = delete;
+    pak_writer& operator=(pak_writer const&) = delete;
+
+    // writes the rest, trims the reserve, false on any write error
+    bool close();
+
+    int64_t size() const {
+        return submitted + (pptr() - pbase());
+    }
+
+    bool direct = false; // O_DIRECT active
+    std::string error;   // first failure
+
+protected:
+    int_type overflow(int_type ch) override;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+
+private:
+    pak_writer() = default;
+
+    bool submit(size_t size); // fill buffer to the thread, waits for the other one
+    bool write_block(char const* data, size_t size, int64_t offset);
+    void loop();
+
+    struct aligned_delete {
+        void operator()(char* data) const {
+            ::operator delete[](data, std::align_val_t(direct_alignment));
+        }
+    };
+    std::unique_ptr<char[], aligned_delete> buffers[2];
+    int fill = 0; // buffer behind the put area
+
+    int64_t submitted = 0; // bytes handed to the thread
+    bool closed = false;
+
+#ifdef _WIN32
+    std::FILE* file = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    char const* pending = nullptr; // guarded by mutex
+    size_t pending_size = 0;
+    int64_t pending_offset = 0;
+    bool stop = false;
+
+    std::thread thread;
+};
+
+} // namespace pl